@@ -37,6 +37,23 @@ GQuark steam_api_error_quark(void)
     return q;
 }
 
+static void steam_api_host_free(SteamApiHost *hst)
+{
+    g_free(hst->host);
+    g_free(hst);
+}
+
+static void steam_api_typing_free(gpointer data)
+{
+    SteamApiTyping *typing = data;
+
+    if (typing->ev > 0)
+        b_event_remove(typing->ev);
+
+    g_free(typing->steamid);
+    g_free(typing);
+}
+
 SteamApi *steam_api_new(const gchar *umqid)
 {
     SteamApi *api;
@@ -53,7 +70,19 @@ SteamApi *steam_api_new(const gchar *umqid)
         api->umqid = g_strdup(umqid);
     }
 
-    api->http = steam_http_new(STEAM_API_AGENT);
+    api->http   = steam_http_new(STEAM_API_AGENT);
+    api->hosts  = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify) steam_api_host_free);
+    api->typing = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        steam_api_typing_free);
+
+    /* Logging on fetches a chatlog for every friend with unread messages */
+    steam_http_pace_set(api->http, STEAM_API_TYPE_CHATLOG,       2, 5);
+    steam_http_pace_set(api->http, STEAM_API_TYPE_FRIEND_ACCEPT, 1, 3);
+    steam_http_pace_set(api->http, STEAM_API_TYPE_FRIEND_ADD,    1, 3);
+    steam_http_pace_set(api->http, STEAM_API_TYPE_FRIEND_IGNORE, 1, 3);
+    steam_http_pace_set(api->http, STEAM_API_TYPE_FRIEND_REMOVE, 1, 3);
+    steam_http_pace_set(api->http, STEAM_API_TYPE_FRIEND_SEARCH, 1, 3);
     return api;
 }
 
@@ -65,6 +94,8 @@ void steam_api_free(SteamApi *api)
         steam_auth_free(api->auth);
 
     steam_http_free(api->http);
+    g_hash_table_destroy(api->typing);
+    g_hash_table_destroy(api->hosts);
 
     g_free(api->sessid);
     g_free(api->token);
@@ -73,6 +104,55 @@ void steam_api_free(SteamApi *api)
     g_free(api);
 }
 
+gboolean steam_api_host_set(SteamApi *api, const gchar *host,
+                            const gchar *uri)
+{
+    SteamApiHost *hst;
+    const gchar  *str;
+    gchar        *end;
+    gint64        port;
+    gboolean      ssl;
+
+    g_return_val_if_fail(api  != NULL, FALSE);
+    g_return_val_if_fail(host != NULL, FALSE);
+
+    if (uri == NULL) {
+        g_hash_table_remove(api->hosts, host);
+        return TRUE;
+    }
+
+    ssl  = TRUE;
+    port = 443;
+
+    if (g_str_has_prefix(uri, "https://")) {
+        uri += 8;
+    } else if (g_str_has_prefix(uri, "http://")) {
+        uri += 7;
+        ssl  = FALSE;
+        port = 80;
+    }
+
+    str = uri + strcspn(uri, ":/");
+
+    if (*str == ':') {
+        port = g_ascii_strtoll(str + 1, &end, 10);
+
+        if (((*end != 0) && (*end != '/')) || (port < 1) || (port > 65535))
+            return FALSE;
+    }
+
+    if (str == uri)
+        return FALSE;
+
+    hst = g_new0(SteamApiHost, 1);
+    hst->host = g_strndup(uri, str - uri);
+    hst->port = port;
+    hst->ssl  = ssl;
+
+    g_hash_table_replace(api->hosts, g_strdup(host), hst);
+    return TRUE;
+}
+
 gint64 steam_api_accountid_int(gint64 steamid)
 {
     return steamid - STEAM_API_STEAMID;
@@ -178,6 +258,12 @@ void steam_api_data_free(SteamApiData *sata)
     if (sata->sums != NULL)
         g_list_free(sata->sums);
 
+    if (sata->sumh != NULL)
+        g_hash_table_destroy(sata->sumh);
+
+    if (sata->sumq != NULL)
+        g_queue_free(sata->sumq);
+
     if (sata->err != NULL)
         g_error_free(sata->err);
 
@@ -304,6 +390,9 @@ static void steam_friend_summary_json(SteamFriendSummary *smry,
 
     steam_json_int(json, "personastate", &in);
     smry->state = in;
+
+    if (steam_json_int(json, "lastlogoff", &in))
+        smry->lastoff = in;
 }
 
 static void steam_api_data_relogon(SteamApiData *sata)
@@ -759,13 +848,12 @@ static void steam_api_poll_cb(SteamApiData *sata, json_value *json)
 
 static void steam_api_summaries_cb(SteamApiData *sata, json_value *json)
 {
-    SteamFriendSummary *smry;
-    json_value         *jv;
-    json_value         *je;
-    const gchar        *str;
-    GList              *l;
-    GList              *c;
-    guint               i;
+    json_value  *jv;
+    json_value  *je;
+    const gchar *str;
+    gpointer     key;
+    GSList      *l;
+    guint        i;
 
     if (!steam_json_val(json, "players", json_array, &jv))
         return;
@@ -779,23 +867,13 @@ static void steam_api_summaries_cb(SteamApiData *sata, json_value *json)
         if (!steam_json_str(je, "steamid", &str))
             continue;
 
-        for (l = sata->sums; l != NULL; ) {
-            smry = l->data;
+        key = GUINT_TO_POINTER(steam_api_accountid_str(str));
 
-            if (g_strcmp0(smry->steamid, str) != 0) {
-                l = l->next;
-                continue;
-            }
+        for (l = g_hash_table_lookup(sata->sumh, key); l != NULL; l = l->next)
+            steam_friend_summary_json(l->data, je);
 
-            c = l;
-            l = l->next;
-
-            sata->sums = g_list_delete_link(sata->sums, c);
-            steam_friend_summary_json(smry, je);
-        }
+        g_hash_table_remove(sata->sumh, key);
     }
-
-    steam_api_summaries(sata);
 }
 
 static void steam_api_summary_cb(SteamApiData *sata, json_value *json)
@@ -826,6 +904,7 @@ static void steam_api_cb(SteamHttpReq *req, gpointer data)
 {
     SteamApiData *sata = data;
     json_value   *json;
+    gboolean      batch;
 
     static const SteamApiParseFunc pfuncs[STEAM_API_TYPE_LAST] = {
         [STEAM_API_TYPE_AUTH]          = steam_api_auth_cb,
@@ -849,36 +928,49 @@ static void steam_api_cb(SteamHttpReq *req, gpointer data)
     if ((sata->type < 0) || (sata->type > STEAM_API_TYPE_LAST))
         return;
 
-    json = NULL;
+    json  = NULL;
+    batch = (sata->pend > 0);
+
+    if (batch)
+        sata->pend--;
 
     if (req->err != NULL) {
-        g_propagate_error(&sata->err, req->err);
+        if (sata->err == NULL)
+            g_propagate_error(&sata->err, req->err);
+        else
+            g_error_free(req->err);
+
         req->err = NULL;
-    } else if (!(sata->flags & STEAM_API_FLAG_NOJSON)) {
+    } else if ((sata->err == NULL) && !(sata->flags & STEAM_API_FLAG_NOJSON)) {
         json = steam_json_new(req->body, &sata->err);
     }
 
     if (sata->err == NULL) {
-        if (sata->sums == NULL) {
+        if (!batch) {
             pfuncs[sata->type](sata, json);
-
-            if (sata->sums != NULL)
-                steam_api_summaries(sata);
         } else if (json != NULL) {
             steam_api_summaries_cb(sata, json);
         }
+
+        steam_api_summaries(sata);
+    } else if (sata->pend > 0) {
+        /* Report the failure once the other batches are back */
+        sata->flags |= STEAM_API_FLAG_NOCALL | STEAM_API_FLAG_NOFREE;
     }
 
-    if (sata->err != NULL)
-        g_prefix_error(&sata->err, "%s: ", steam_api_type_str(sata->type));
+    if (!(sata->flags & STEAM_API_FLAG_NOCALL)) {
+        if (sata->err != NULL) {
+            g_prefix_error(&sata->err, "%s: ",
+                           steam_api_type_str(sata->type));
+        }
 
-    if (!(sata->flags & STEAM_API_FLAG_NOCALL))
         steam_api_data_func(sata);
+    }
 
     if (json != NULL)
         json_value_free(json);
 
-    if (sata->req->flags & STEAM_HTTP_REQ_FLAG_NOFREE)
+    if (req->flags & STEAM_HTTP_REQ_FLAG_NOFREE)
         sata->flags |= STEAM_API_FLAG_NOFREE;
 
     if (!(sata->flags & STEAM_API_FLAG_NOFREE)) {
@@ -889,18 +981,69 @@ static void steam_api_cb(SteamHttpReq *req, gpointer data)
     }
 }
 
-static void steam_api_data_req(SteamApiData *sata, const gchar *host,
-                               const gchar *path)
+static void steam_api_data_req_type(SteamApiData *sata, SteamApiType type,
+                                    const gchar *host, const gchar *path)
 {
+    static const SteamHttpRetry retries[STEAM_API_TYPE_LAST] = {
+        [STEAM_API_TYPE_AUTH]    = {2, 1000, 10000},
+        [STEAM_API_TYPE_LOGON]   = {2, 1000, 10000},
+        [STEAM_API_TYPE_RELOGON] = {2, 1000, 10000},
+        [STEAM_API_TYPE_MESSAGE] = {3, 500,  8000},
+        [STEAM_API_TYPE_POLL]    = {5, 2000, 60000}
+    };
+
     SteamApi     *api = sata->api;
+    SteamApiHost *hst;
     SteamHttpReq *req;
 
-    req = steam_http_req_new(api->http, host, 443, path, steam_api_cb, sata);
+    /* Hosts may be pointed elsewhere, such as at a local mock */
+    hst = g_hash_table_lookup(api->hosts, host);
+
+    if (hst != NULL) {
+        req = steam_http_req_new(api->http, hst->host, hst->port, path,
+                                 steam_api_cb, sata);
+    } else {
+        req = steam_http_req_new(api->http, host, 443, path, steam_api_cb,
+                                 sata);
+    }
+
+    /* Endpoints without an explicit policy use the HTTP defaults */
+    if (retries[type].max > 0)
+        steam_http_req_retry_set(req, &retries[type]);
+
+    switch (type) {
+    case STEAM_API_TYPE_FRIEND_ACCEPT:
+    case STEAM_API_TYPE_FRIEND_ADD:
+    case STEAM_API_TYPE_FRIEND_IGNORE:
+    case STEAM_API_TYPE_FRIEND_REMOVE:
+    case STEAM_API_TYPE_FRIEND_SEARCH:
+    case STEAM_API_TYPE_MESSAGE:
+        req->prio = STEAM_HTTP_PRIO_SEND;
+        break;
+
+    case STEAM_API_TYPE_POLL:
+        req->prio = STEAM_HTTP_PRIO_POLL;
+        break;
+
+    case STEAM_API_TYPE_CHATLOG:
+        req->prio = STEAM_HTTP_PRIO_BACKFILL;
+        break;
+
+    default:
+        break;
+    }
 
-    req->flags = STEAM_HTTP_REQ_FLAG_SSL;
+    req->flags = ((hst == NULL) || hst->ssl) ? STEAM_HTTP_REQ_FLAG_SSL : 0;
+    req->stat  = type;
     sata->req  = req;
 }
 
+static void steam_api_data_req(SteamApiData *sata, const gchar *host,
+                               const gchar *path)
+{
+    steam_api_data_req_type(sata, sata->type, host, path);
+}
+
 void steam_api_auth(SteamApi *api, const gchar *user, const gchar *pass,
                     const gchar *authcode, const gchar *captcha,
                     SteamApiFunc func, gpointer data)
@@ -989,7 +1132,7 @@ void steam_api_chatlog(SteamApi *api, const gchar *steamid,
         NULL
     );
 
-    sata->req->flags |= STEAM_HTTP_REQ_FLAG_POST;
+    sata->req->flags |= STEAM_HTTP_REQ_FLAG_POST | STEAM_HTTP_REQ_FLAG_IDEMP;
     steam_http_req_send(sata->req);
 
     g_free(path);
@@ -1157,6 +1300,7 @@ void steam_api_friends(SteamApi *api, SteamApiListFunc func, gpointer data)
         NULL
     );
 
+    sata->req->flags |= STEAM_HTTP_REQ_FLAG_SHARED;
     steam_http_req_send(sata->req);
 }
 
@@ -1181,7 +1325,7 @@ void steam_api_key(SteamApi *api, const gchar *user, SteamApiFunc func,
         NULL
     );
 
-    sata->req->flags |= STEAM_HTTP_REQ_FLAG_POST;
+    sata->req->flags |= STEAM_HTTP_REQ_FLAG_POST | STEAM_HTTP_REQ_FLAG_IDEMP;
     steam_http_req_send(sata->req);
     g_free(ms);
 }
@@ -1245,15 +1389,75 @@ void steam_api_relogon(SteamApi *api, SteamApiFunc func, gpointer data)
     steam_http_req_send(sata->req);
 }
 
+static gboolean steam_api_typing_cb(gpointer data, gint fd,
+                                    b_input_condition cond)
+{
+    SteamApiTyping *typing = data;
+    SteamApi       *api    = typing->api;
+
+    typing->ev = 0;
+
+    /* Kept while the notice is in flight or waiting in its lane */
+    if (steam_http_req_lookup(api->http, typing->id) != NULL) {
+        typing->ev = b_timeout_add(STEAM_API_TYPING * 1000,
+                                   steam_api_typing_cb, typing);
+        return FALSE;
+    }
+
+    g_hash_table_remove(api->typing, typing->steamid);
+    return FALSE;
+}
+
 void steam_api_message(SteamApi *api, const SteamApiMessage *mesg,
                        SteamApiFunc func, gpointer data)
 {
-    SteamApiData *sata;
-    const gchar  *type;
+    SteamApiTyping *typing;
+    SteamApiData   *sata;
+    SteamHttpReq   *req;
+    const gchar    *type;
+    gint64          now;
 
     g_return_if_fail(api  != NULL);
     g_return_if_fail(mesg != NULL);
 
+    now    = g_get_monotonic_time();
+    typing = g_hash_table_lookup(api->typing, mesg->smry->steamid);
+    req    = NULL;
+
+    if (typing != NULL) {
+        req = steam_http_req_lookup(api->http, typing->id);
+    }
+
+    switch (mesg->type) {
+    case STEAM_API_MESSAGE_TYPE_SAYTEXT:
+    case STEAM_API_MESSAGE_TYPE_EMOTE:
+        /* The message supersedes a notice still waiting in front of it */
+        if ((req != NULL) && steam_http_req_waiting(req)) {
+            sata = req->data;
+            steam_http_req_free(req);
+            steam_api_data_free(sata);
+        }
+
+        /* Steam clears the notice with the message, allow the next one */
+        if (typing != NULL)
+            typing->stamp = 0;
+
+        break;
+
+    case STEAM_API_MESSAGE_TYPE_TYPING:
+        /* One notice at a time, and no more often than Steam shows them */
+        if ((req != NULL) || ((typing != NULL) &&
+            ((now - typing->stamp) < (STEAM_API_TYPING * G_USEC_PER_SEC))))
+        {
+            return;
+        }
+
+        break;
+
+    default:
+        break;
+    }
+
     type = steam_api_message_type_str(mesg->type);
     sata = steam_api_data_new(api, STEAM_API_TYPE_MESSAGE, func, data);
     steam_api_data_req(sata, STEAM_API_HOST, STEAM_API_PATH_MESSAGE);
@@ -1276,6 +1480,21 @@ void steam_api_message(SteamApi *api, const SteamApiMessage *mesg,
         break;
 
     case STEAM_API_MESSAGE_TYPE_TYPING:
+        if (typing == NULL) {
+            typing = g_new0(SteamApiTyping, 1);
+            typing->api     = api;
+            typing->steamid = g_strdup(mesg->smry->steamid);
+            g_hash_table_insert(api->typing, typing->steamid, typing);
+        }
+
+        /* Dropped once the notice is done and the next one is allowed */
+        if (typing->ev > 0)
+            b_event_remove(typing->ev);
+
+        typing->id    = sata->req->id;
+        typing->stamp = now;
+        typing->ev    = b_timeout_add(STEAM_API_TYPING * 1000,
+                                      steam_api_typing_cb, typing);
         break;
 
     default:
@@ -1283,6 +1502,8 @@ void steam_api_message(SteamApi *api, const SteamApiMessage *mesg,
         return;
     }
 
+    steam_http_req_lane_set(sata->req, mesg->smry->steamid);
+
     sata->req->flags |= STEAM_HTTP_REQ_FLAG_QUEUED | STEAM_HTTP_REQ_FLAG_POST;
     steam_http_req_send(sata->req);
 }
@@ -1301,11 +1522,6 @@ void steam_api_poll(SteamApi *api, SteamApiListFunc func, gpointer data)
     sata = steam_api_data_new(api, STEAM_API_TYPE_POLL, func, data);
     steam_api_data_req(sata, STEAM_API_HOST, STEAM_API_PATH_POLL);
 
-    steam_http_req_headers_set(sata->req,
-        STEAM_HTTP_PAIR("Connection", "Keep-Alive"),
-        NULL
-    );
-
     steam_http_req_params_set(sata->req,
         STEAM_HTTP_PAIR("access_token", api->token),
         STEAM_HTTP_PAIR("umqid",        api->umqid),
@@ -1314,7 +1530,7 @@ void steam_api_poll(SteamApi *api, SteamApiListFunc func, gpointer data)
         NULL
     );
 
-    sata->req->flags |= STEAM_HTTP_REQ_FLAG_POST;
+    sata->req->flags |= STEAM_HTTP_REQ_FLAG_POST | STEAM_HTTP_REQ_FLAG_IDEMP;
     steam_http_req_send(sata->req);
 
     g_free(tout);
@@ -1324,45 +1540,78 @@ void steam_api_poll(SteamApi *api, SteamApiListFunc func, gpointer data)
 static void steam_api_summaries(SteamApiData *sata)
 {
     SteamFriendSummary *smry;
-    GHashTable         *tbl;
     GString            *gstr;
+    GSList             *smrys;
     GList              *l;
+    gpointer            key;
+    gint64              in;
     gsize               i;
 
     if (sata->sums == NULL)
-        return;
+        goto dispatch;
 
-    sata->flags |= STEAM_API_FLAG_NOCALL | STEAM_API_FLAG_NOFREE;
+    if (sata->sumh == NULL) {
+        sata->sumh = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL,
+                                           (GDestroyNotify) g_slist_free);
+        sata->sumq = g_queue_new();
+    }
+
+    /* Index by account ID, an ID already pending is requested once */
+    for (l = sata->sums; l != NULL; l = l->next) {
+        smry  = l->data;
+        key   = GUINT_TO_POINTER(steam_api_accountid_str(smry->steamid));
+        smrys = g_hash_table_lookup(sata->sumh, key);
+
+        if (smrys == NULL)
+            g_queue_push_tail(sata->sumq, key);
+
+        /* Steal, the old list becomes the tail of the new one */
+        g_hash_table_steal(sata->sumh, key);
+        g_hash_table_insert(sata->sumh, key, g_slist_prepend(smrys, smry));
+    }
+
+    g_list_free(sata->sums);
+    sata->sums = NULL;
+
+dispatch:
+    if (sata->sumq == NULL)
+        return;
 
-    tbl  = g_hash_table_new(g_str_hash, g_str_equal);
     gstr = g_string_sized_new(2048);
 
-    for (l = sata->sums, i = 0; l != NULL; l = l->next) {
-        smry = l->data;
+    /* Batches go out together, each is merged as soon as it returns */
+    while (!g_queue_is_empty(sata->sumq) && (sata->pend < STEAM_API_BATCHES)) {
+        g_string_truncate(gstr, 0);
 
-        if (g_hash_table_contains(tbl, smry->steamid))
-            continue;
+        for (i = 0; !g_queue_is_empty(sata->sumq) && (i < 100); i++) {
+            key = g_queue_pop_head(sata->sumq);
+            in  = steam_api_steamid_int(GPOINTER_TO_UINT(key));
+            g_string_append_printf(gstr, "%" G_GINT64_FORMAT ",", in);
+        }
 
-        g_hash_table_add(tbl, smry->steamid);
-        g_string_append_printf(gstr, "%s,", smry->steamid);
+        /* Remove trailing comma */
+        gstr->str[gstr->len - 1] = 0;
 
-        if ((++i % 100) == 0)
-            break;
-    }
+        /* Batches may be started by a poll, but are not a poll themselves */
+        steam_api_data_req_type(sata, STEAM_API_TYPE_SUMMARY, STEAM_API_HOST,
+                                 STEAM_API_PATH_SUMMARIES);
 
-    /* Remove trailing comma */
-    gstr->str[gstr->len - 1] = 0;
-    steam_api_data_req(sata, STEAM_API_HOST, STEAM_API_PATH_SUMMARIES);
+        steam_http_req_params_set(sata->req,
+            STEAM_HTTP_PAIR("access_token", sata->api->token),
+            STEAM_HTTP_PAIR("steamids",     gstr->str),
+            NULL
+        );
 
-    steam_http_req_params_set(sata->req,
-        STEAM_HTTP_PAIR("access_token", sata->api->token),
-        STEAM_HTTP_PAIR("steamids",     gstr->str),
-        NULL
-    );
+        sata->pend++;
+        sata->req->flags |= STEAM_HTTP_REQ_FLAG_SHARED;
+        steam_http_req_send(sata->req);
+    }
+
+    if (sata->pend > 0)
+        sata->flags |= STEAM_API_FLAG_NOCALL | STEAM_API_FLAG_NOFREE;
 
-    steam_http_req_send(sata->req);
     g_string_free(gstr, TRUE);
-    g_hash_table_destroy(tbl);
 }
 
 void steam_api_summary(SteamApi *api, const gchar *steamid,
@@ -1381,5 +1630,6 @@ void steam_api_summary(SteamApi *api, const gchar *steamid,
         NULL
     );
 
+    sata->req->flags |= STEAM_HTTP_REQ_FLAG_SHARED;
     steam_http_req_send(sata->req);
 }
@@ -28,6 +28,8 @@
 #define STEAM_API_CLIENTID "DE45CD61"
 #define STEAM_API_STEAMID  76561197960265728
 #define STEAM_API_TIMEOUT  30
+#define STEAM_API_TYPING   5
+#define STEAM_API_BATCHES  8
 
 #define STEAM_API_PATH_FRIEND_SEARCH "/ISteamUserOAuth/Search/v0001"
 #define STEAM_API_PATH_FRIENDS       "/ISteamUserOAuth/GetFriendList/v0001"
@@ -53,7 +55,9 @@ typedef enum   _SteamApiMessageType SteamApiMessageType;
 typedef enum   _SteamApiType        SteamApiType;
 typedef struct _SteamApi            SteamApi;
 typedef struct _SteamApiData        SteamApiData;
+typedef struct _SteamApiHost        SteamApiHost;
 typedef struct _SteamApiMessage     SteamApiMessage;
+typedef struct _SteamApiTyping      SteamApiTyping;
 
 typedef void (*SteamApiFunc)        (SteamApi *api, GError *err,gpointer data);
 typedef void (*SteamApiIdFunc)      (SteamApi *api, gchar *steamid,
@@ -138,8 +142,10 @@ struct _SteamApi
     gint64 lmid;
     gint64 tstamp;
 
-    SteamHttp *http;
-    SteamAuth *auth;
+    SteamHttp  *http;
+    SteamAuth  *auth;
+    GHashTable *hosts;
+    GHashTable *typing;
 };
 
 struct _SteamApiData
@@ -156,9 +162,29 @@ struct _SteamApiData
     GDestroyNotify rfunc;
 
     GList        *sums;
+    GHashTable   *sumh;
+    GQueue       *sumq;
+    guint         pend;
     SteamHttpReq *req;
 };
 
+struct _SteamApiHost
+{
+    gchar    *host;
+    gint      port;
+    gboolean  ssl;
+};
+
+struct _SteamApiTyping
+{
+    SteamApi *api;
+    gchar    *steamid;
+
+    guint  id;
+    gint64 stamp;
+    gint   ev;
+};
+
 struct _SteamApiMessage
 {
     SteamApiMessageType  type;
@@ -176,6 +202,9 @@ SteamApi *steam_api_new(const gchar *umqid);
 
 void steam_api_free(SteamApi *api);
 
+gboolean steam_api_host_set(SteamApi *api, const gchar *host,
+                            const gchar *uri);
+
 gint64 steam_api_accountid_int(gint64 steamid);
 
 gint64 steam_api_accountid_str(const gchar *steamid);
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "steam-api.h"
+#include "steam-cache.h"
+
+#define STEAM_CACHE_ALIGN(n) (((n) + 7) & ~((gsize) 7))
+
+GQuark steam_cache_error_quark(void)
+{
+    static GQuark q;
+
+    if (G_UNLIKELY(q == 0))
+        q = g_quark_from_static_string("steam-cache-error-quark");
+
+    return q;
+}
+
+SteamCache *steam_cache_new(const gchar *path)
+{
+    SteamCache *cache;
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    cache = g_new0(SteamCache, 1);
+    cache->path = g_strdup(path);
+    cache->sums = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        (GDestroyNotify)
+                                        steam_friend_summary_free);
+
+    return cache;
+}
+
+void steam_cache_free(SteamCache *cache)
+{
+    g_return_if_fail(cache != NULL);
+
+    g_hash_table_destroy(cache->sums);
+    g_free(cache->path);
+    g_free(cache);
+}
+
+static gchar *steam_cache_str(const gchar *data, guint16 len)
+{
+    return (len > 0) ? g_strndup(data, len) : NULL;
+}
+
+gboolean steam_cache_load(SteamCache *cache, GError **err)
+{
+    SteamFriendSummary *smry;
+    SteamCacheHdr       hdr;
+    SteamCacheRec       rec;
+    GMappedFile        *map;
+    GError             *ferr;
+    const gchar        *data;
+    const gchar        *str;
+    gchar              *steamid;
+    gsize               size;
+    gsize               rsize;
+    gsize               pos;
+    guint               i;
+
+    g_return_val_if_fail(cache != NULL, FALSE);
+
+    ferr = NULL;
+    map  = g_mapped_file_new(cache->path, FALSE, &ferr);
+
+    if (map == NULL) {
+        /* Without a cache the roster waits for the friends list */
+        if (g_error_matches(ferr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_error_free(ferr);
+            return TRUE;
+        }
+
+        g_propagate_error(err, ferr);
+        return FALSE;
+    }
+
+    data = g_mapped_file_get_contents(map);
+    size = g_mapped_file_get_length(map);
+
+    if (size < sizeof hdr) {
+        g_mapped_file_unref(map);
+        return TRUE;
+    }
+
+    memcpy(&hdr, data, sizeof hdr);
+
+    /* Caches from another version are rebuilt rather than converted */
+    if ((hdr.magic != STEAM_CACHE_MAGIC) ||
+        (hdr.version != STEAM_CACHE_VERSION))
+    {
+        g_mapped_file_unref(map);
+        return TRUE;
+    }
+
+    pos = sizeof hdr;
+
+    for (i = 0; i < hdr.count; i++) {
+        if ((size - pos) < sizeof rec)
+            break;
+
+        memcpy(&rec, data + pos, sizeof rec);
+        rsize = sizeof rec + rec.lens[0] + rec.lens[1] + rec.lens[2] +
+                rec.lens[3];
+
+        if ((size - pos) < rsize)
+            break;
+
+        str     = data + pos + sizeof rec;
+        steamid = g_strdup_printf("%" G_GINT64_FORMAT,
+                                  steam_api_steamid_int(rec.accid));
+
+        smry = steam_friend_summary_new(steamid);
+        smry->lastoff  = rec.lastoff;
+        smry->state    = rec.state;
+        smry->relation = rec.relation;
+
+        smry->nick     = steam_cache_str(str, rec.lens[0]);
+        str           += rec.lens[0];
+        smry->fullname = steam_cache_str(str, rec.lens[1]);
+        str           += rec.lens[1];
+        smry->game     = steam_cache_str(str, rec.lens[2]);
+        str           += rec.lens[2];
+        smry->server   = steam_cache_str(str, rec.lens[3]);
+
+        g_hash_table_replace(cache->sums, smry->steamid, smry);
+        g_free(steamid);
+
+        pos += MIN(STEAM_CACHE_ALIGN(rsize), size - pos);
+    }
+
+    g_mapped_file_unref(map);
+
+    if (i < hdr.count) {
+        g_hash_table_remove_all(cache->sums);
+        g_set_error(err, STEAM_CACHE_ERROR, STEAM_CACHE_ERROR_PARSE,
+                    "%s: truncated at record %u", cache->path, i);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static guint16 steam_cache_len(const gchar *str)
+{
+    return (str != NULL) ? MIN(strlen(str), G_MAXUINT16) : 0;
+}
+
+gboolean steam_cache_save(SteamCache *cache, GError **err)
+{
+    static const gchar  zero[8] = {0};
+    SteamFriendSummary *smry;
+    GHashTableIter      iter;
+    SteamCacheHdr       hdr;
+    SteamCacheRec       rec;
+    GString            *gstr;
+    gsize               rsize;
+    gboolean            ret;
+
+    g_return_val_if_fail(cache != NULL, FALSE);
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.magic   = STEAM_CACHE_MAGIC;
+    hdr.version = STEAM_CACHE_VERSION;
+    hdr.count   = g_hash_table_size(cache->sums);
+
+    gstr = g_string_sized_new(sizeof hdr + (hdr.count * 64));
+    g_string_append_len(gstr, (gchar *) &hdr, sizeof hdr);
+    g_hash_table_iter_init(&iter, cache->sums);
+
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &smry)) {
+        memset(&rec, 0, sizeof rec);
+        rec.lastoff  = smry->lastoff;
+        rec.accid    = steam_api_accountid_str(smry->steamid);
+        rec.state    = smry->state;
+        rec.relation = smry->relation;
+        rec.lens[0]  = steam_cache_len(smry->nick);
+        rec.lens[1]  = steam_cache_len(smry->fullname);
+        rec.lens[2]  = steam_cache_len(smry->game);
+        rec.lens[3]  = steam_cache_len(smry->server);
+
+        rsize = sizeof rec + rec.lens[0] + rec.lens[1] + rec.lens[2] +
+                rec.lens[3];
+
+        g_string_append_len(gstr, (gchar *) &rec, sizeof rec);
+        g_string_append_len(gstr, smry->nick,     rec.lens[0]);
+        g_string_append_len(gstr, smry->fullname, rec.lens[1]);
+        g_string_append_len(gstr, smry->game,     rec.lens[2]);
+        g_string_append_len(gstr, smry->server,   rec.lens[3]);
+        g_string_append_len(gstr, zero, STEAM_CACHE_ALIGN(rsize) - rsize);
+    }
+
+    /* Replaced by rename, a reader never maps a half written file */
+    ret = g_file_set_contents(cache->path, gstr->str, gstr->len, err);
+    g_string_free(gstr, TRUE);
+    return ret;
+}
+
+static void steam_cache_set(gchar **dest, const gchar *src)
+{
+    if (g_strcmp0(*dest, src) == 0)
+        return;
+
+    g_free(*dest);
+    *dest = g_strdup(src);
+}
+
+void steam_cache_update(SteamCache *cache, const SteamFriendSummary *smry)
+{
+    SteamFriendSummary *csmry;
+
+    g_return_if_fail(cache != NULL);
+    g_return_if_fail(smry  != NULL);
+
+    csmry = g_hash_table_lookup(cache->sums, smry->steamid);
+
+    if (csmry == NULL) {
+        csmry = steam_friend_summary_new(smry->steamid);
+        g_hash_table_insert(cache->sums, csmry->steamid, csmry);
+    }
+
+    csmry->state    = smry->state;
+    csmry->relation = smry->relation;
+
+    if (smry->lastoff > 0)
+        csmry->lastoff = smry->lastoff;
+
+    steam_cache_set(&csmry->nick,     smry->nick);
+    steam_cache_set(&csmry->fullname, smry->fullname);
+    steam_cache_set(&csmry->game,     smry->game);
+    steam_cache_set(&csmry->server,   smry->server);
+}
+
+void steam_cache_remove(SteamCache *cache, const gchar *steamid)
+{
+    g_return_if_fail(cache   != NULL);
+    g_return_if_fail(steamid != NULL);
+
+    g_hash_table_remove(cache->sums, steamid);
+}
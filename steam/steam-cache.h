@@ -0,0 +1,80 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STEAM_CACHE_H
+#define _STEAM_CACHE_H
+
+#include <bitlbee.h>
+
+#include "steam-friend.h"
+
+#define STEAM_CACHE_ERROR steam_cache_error_quark()
+
+#define STEAM_CACHE_MAGIC   0x53544643
+#define STEAM_CACHE_VERSION 1
+
+typedef enum   _SteamCacheError SteamCacheError;
+typedef struct _SteamCache      SteamCache;
+typedef struct _SteamCacheHdr   SteamCacheHdr;
+typedef struct _SteamCacheRec   SteamCacheRec;
+
+enum _SteamCacheError
+{
+    STEAM_CACHE_ERROR_PARSE = 0
+};
+
+struct _SteamCache
+{
+    gchar      *path;
+    GHashTable *sums;
+};
+
+/* The file is written in host byte order, a foreign one fails the magic */
+struct _SteamCacheHdr
+{
+    guint32 magic;
+    guint32 version;
+    guint32 count;
+    guint32 reserved;
+};
+
+/* Followed by the strings, without terminators, padded to 8 bytes */
+struct _SteamCacheRec
+{
+    gint64  lastoff;
+    guint32 accid;
+    guint16 lens[4];
+    guint8  state;
+    guint8  relation;
+    guint16 reserved;
+};
+
+GQuark steam_cache_error_quark(void);
+
+SteamCache *steam_cache_new(const gchar *path);
+
+void steam_cache_free(SteamCache *cache);
+
+gboolean steam_cache_load(SteamCache *cache, GError **err);
+
+gboolean steam_cache_save(SteamCache *cache, GError **err);
+
+void steam_cache_update(SteamCache *cache, const SteamFriendSummary *smry);
+
+void steam_cache_remove(SteamCache *cache, const gchar *steamid);
+
+#endif /* _STEAM_CACHE_H */
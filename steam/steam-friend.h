@@ -76,6 +76,8 @@ struct _SteamFriendSummary
     gchar *fullname;
     gchar *game;
     gchar *server;
+
+    gint64 lastoff;
 };
 
 
@@ -20,6 +20,17 @@
 
 #include "steam-glib.h"
 
+#if !GLIB_CHECK_VERSION(2, 28, 0)
+/* Compatibility with glib < 2.28 */
+gint64 g_get_monotonic_time(void)
+{
+    GTimeVal tv;
+
+    g_get_current_time(&tv);
+    return ((gint64) tv.tv_sec * G_USEC_PER_SEC) + tv.tv_usec;
+}
+#endif
+
 #ifndef g_hash_table_add
 /* Compatibility with glib < 2.32 */
 void g_hash_table_add(GHashTable *hash_table, gpointer key)
@@ -68,6 +79,22 @@ void g_slist_free_full(GSList *list, GDestroyNotify free_func)
 }
 #endif
 
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+/* Compatibility with glib < 2.32 */
+GThread *g_thread_new(const gchar *name, GThreadFunc func, gpointer data)
+{
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+
+    return g_thread_create(func, data, FALSE, NULL);
+}
+
+void g_thread_unref(GThread *thread)
+{
+    /* Nothing to release, the threads above are created detached */
+}
+#endif
+
 #ifndef g_strcmp0
 /* Compatibility with glib < 2.16 */
 int g_strcmp0(const char *str1, const char *str2)
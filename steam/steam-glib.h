@@ -20,6 +20,10 @@
 
 #include <glib.h>
 
+#if !GLIB_CHECK_VERSION(2, 28, 0)
+gint64 g_get_monotonic_time(void);
+#endif
+
 #ifndef g_hash_table_add
 void g_hash_table_add(GHashTable *hash_table, gpointer key);
 #endif
@@ -36,6 +40,11 @@ void g_prefix_error(GError **err, const gchar *format, ...);
 void g_slist_free_full(GSList *list, GDestroyNotify free_func);
 #endif
 
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+GThread *g_thread_new(const gchar *name, GThreadFunc func, gpointer data);
+void g_thread_unref(GThread *thread);
+#endif
+
 #ifndef g_strcmp0
 int g_strcmp0(const char *str1, const char *str2);
 #endif
@@ -16,43 +16,1270 @@
  */
 
 #include <bitlbee.h>
+#include <errno.h>
+#include <netdb.h>
+#include <ssl_client.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
 
 #include "steam-glib.h"
 #include "steam-http.h"
 
-#ifdef DEBUG
-global_t global;
-#endif /* DEBUG */
+static void steam_http_conn_free(SteamHttpConn *conn);
+static void steam_http_conn_resolve(SteamHttpConn *conn);
+static void steam_http_req_cb(SteamHttpReq *req);
+static void steam_http_req_done(SteamHttpReq *req);
+static void steam_http_req_queue(SteamHttp *http);
+static void steam_http_req_sendasm(SteamHttpReq *req);
+
+static gpointer steam_http_arena_alloc(SteamHttpArena *arena, gsize size,
+                                       gboolean align)
+{
+    gpointer ret;
+    gsize    bsize;
+    gsize    pad;
+
+    if (align)
+        pad = -GPOINTER_TO_SIZE(arena->pos) & (sizeof (gpointer) - 1);
+    else
+        pad = 0;
+
+    if ((size + pad) > arena->rem) {
+        /* Each block leads with a link to the previous one */
+        bsize = MAX(size, STEAM_HTTP_ARENA_SIZE) + sizeof (gpointer);
+        ret   = g_malloc(bsize);
+
+        *((gpointer *) ret) = arena->blocks;
+        arena->blocks = ret;
+        arena->pos    = (gchar *) ret + sizeof (gpointer);
+        arena->rem    = bsize - sizeof (gpointer);
+        pad           = 0;
+    }
+
+    ret = arena->pos + pad;
+    arena->pos += size + pad;
+    arena->rem -= size + pad;
+    return ret;
+}
+
+static gchar *steam_http_arena_strdup(SteamHttpArena *arena, const gchar *str)
+{
+    gchar *ret;
+    gsize  size;
+
+    if (str == NULL)
+        return NULL;
+
+    size = strlen(str) + 1;
+    ret  = steam_http_arena_alloc(arena, size, FALSE);
+
+    memcpy(ret, str, size);
+    return ret;
+}
+
+static void steam_http_arena_free(SteamHttpArena *arena)
+{
+    gpointer blk;
+
+    while ((blk = arena->blocks) != NULL) {
+        arena->blocks = *((gpointer *) blk);
+        g_free(blk);
+    }
+}
+
+static void steam_http_pairs_ins(SteamHttpPairs *pairs, SteamHttpArena *arena,
+                                 SteamHttpPair *pair, va_list ap)
+{
+    SteamHttpPair *p;
+    SteamHttpPair *ps;
+    guint          i;
+
+    for (p = pair; p != NULL; p = va_arg(ap, SteamHttpPair*)) {
+        if (p->key == NULL)
+            continue;
+
+        for (i = 0; i < pairs->size; i++) {
+            if (g_ascii_strcasecmp(pairs->pairs[i].key, p->key) == 0)
+                break;
+        }
+
+        if (i < pairs->size) {
+            pairs->pairs[i].val = steam_http_arena_strdup(arena, p->val);
+            continue;
+        }
+
+        if (pairs->size >= pairs->alloc) {
+            ps = steam_http_arena_alloc(arena, sizeof *ps * pairs->alloc * 2,
+                                        TRUE);
+            memcpy(ps, pairs->pairs, sizeof *ps * pairs->size);
+
+            pairs->pairs  = ps;
+            pairs->alloc *= 2;
+        }
+
+        ps = &pairs->pairs[pairs->size++];
+        ps->key = steam_http_arena_strdup(arena, p->key);
+        ps->val = steam_http_arena_strdup(arena, p->val);
+    }
+}
+
+GQuark steam_http_error_quark(void)
+{
+    static GQuark q;
+
+    if (G_UNLIKELY(q == 0))
+        q = g_quark_from_static_string("steam-http-error-quark");
+
+    return q;
+}
+
+static void steam_http_link_push(GQueue *queue, GList *link, gpointer data,
+                                 gboolean head)
+{
+    /* Each link only ever belongs to the one queue, requeue in place */
+    if (link->data != NULL)
+        g_queue_unlink(queue, link);
+
+    link->data = data;
+
+    if (head)
+        g_queue_push_head_link(queue, link);
+    else
+        g_queue_push_tail_link(queue, link);
+}
+
+static gboolean steam_http_link_remove(GQueue *queue, GList *link)
+{
+    /* The data pointer doubles as the membership marker */
+    if (link->data == NULL)
+        return FALSE;
+
+    g_queue_unlink(queue, link);
+    link->data = NULL;
+    return TRUE;
+}
+
+static void steam_http_req_mark(SteamHttpReq *req, SteamHttpMark mark)
+{
+    if ((req != NULL) && (req->marks != NULL))
+        req->marks[mark] = g_get_monotonic_time();
+}
+
+static void steam_http_bucket_init(SteamHttpBucket *bkt, gdouble rate,
+                                   guint burst)
+{
+    bkt->rate   = rate;
+    bkt->burst  = MAX(burst, 1);
+    bkt->tokens = bkt->burst;
+    bkt->scale  = 1;
+    bkt->stamp  = g_get_monotonic_time();
+}
+
+static guint steam_http_bucket_take(SteamHttpBucket *bkt)
+{
+    gdouble rate;
+    gint64  now;
+
+    /* A rate of zero leaves the bucket unlimited */
+    if (bkt->rate <= 0)
+        return 0;
+
+    now  = g_get_monotonic_time();
+    rate = bkt->rate * bkt->scale;
+
+    bkt->tokens += rate * (now - bkt->stamp) / G_USEC_PER_SEC;
+    bkt->tokens  = MIN(bkt->tokens, bkt->burst);
+    bkt->stamp   = now;
+
+    /* Tokens go into debt, spacing out everyone waiting behind */
+    bkt->tokens -= 1;
+
+    if (bkt->tokens >= 0)
+        return 0;
+
+    return (guint) (-bkt->tokens * 1000 / rate) + 1;
+}
+
+static void steam_http_bucket_adapt(SteamHttpBucket *bkt, gboolean limited)
+{
+    /* Halve on rate limiting, creep back up with every success */
+    if (limited)
+        bkt->scale = MAX(bkt->scale / 2, 1.0 / STEAM_HTTP_PACE_FLOOR);
+    else
+        bkt->scale = MIN(bkt->scale + 1.0 / STEAM_HTTP_PACE_STEP, 1);
+}
+
+static gchar *steam_http_pool_key(const gchar *host, gint port)
+{
+    return g_strdup_printf("%s:%d", host, port);
+}
+
+static SteamHttpPool *steam_http_pool_new(SteamHttp *http, const gchar *host,
+                                          gint port, gboolean ssl)
+{
+    SteamHttpPool *pool;
+    guint          i;
+
+    pool = g_new0(SteamHttpPool, 1);
+
+    pool->http  = http;
+    pool->host  = g_strdup(host);
+    pool->port  = port;
+    pool->ssl   = ssl;
+    pool->idle  = g_queue_new();
+    pool->sizes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    for (i = 0; i < STEAM_HTTP_PRIO_LAST; i++)
+        pool->waitq[i] = g_queue_new();
+
+    steam_http_bucket_init(&pool->bucket, http->prate, http->pburst);
+
+    pool->header = g_strdup_printf("User-Agent: %s\r\n"
+                                   "Host: %s\r\n"
+                                   "Accept: */*\r\n"
+                                   "Accept-Encoding: gzip, deflate\r\n"
+                                   "Connection: Keep-Alive\r\n",
+                                   http->agent, host);
+    pool->header_size = strlen(pool->header);
+    return pool;
+}
+
+static void steam_http_pool_free(SteamHttpPool *pool)
+{
+    SteamHttpConn *conn;
+    guint          i;
+
+    while ((conn = g_queue_peek_head(pool->idle)) != NULL)
+        steam_http_conn_free(conn);
+
+    if (pool->warm != NULL)
+        steam_http_conn_free(pool->warm);
+
+    for (i = 0; i < STEAM_HTTP_PRIO_LAST; i++)
+        g_queue_free(pool->waitq[i]);
+
+    g_queue_free(pool->idle);
+    g_hash_table_destroy(pool->sizes);
+
+    g_free(pool->header);
+    g_free(pool->host);
+    g_free(pool);
+}
+
+static SteamHttpPool *steam_http_pool_get(SteamHttp *http, SteamHttpReq *req,
+                                          gboolean create)
+{
+    SteamHttpPool *pool;
+    gchar         *key;
+
+    key  = steam_http_pool_key(req->host, req->port);
+    pool = g_hash_table_lookup(http->pools, key);
+
+    if ((pool != NULL) || !create) {
+        g_free(key);
+        return pool;
+    }
+
+    pool = steam_http_pool_new(http, req->host, req->port,
+                               (req->flags & STEAM_HTTP_REQ_FLAG_SSL));
+    g_hash_table_insert(http->pools, key, pool);
+    return pool;
+}
+
+static gboolean steam_http_conn_again(SteamHttpConn *conn)
+{
+    if (conn->ssl != NULL)
+        return (ssl_errno == SSL_AGAIN);
+
+    return sockerr_again();
+}
+
+static b_input_condition steam_http_conn_dir(SteamHttpConn *conn,
+                                             b_input_condition cond)
+{
+    if (conn->ssl != NULL)
+        return ssl_getdirection(conn->ssl);
+
+    return cond;
+}
+
+static GHashTable *steam_http_dns;
+static gint        steam_http_dns_fds[2] = {-1, -1};
+static gint        steam_http_dns_ev;
+static pid_t       steam_http_dns_pid;
+
+static void steam_http_conn_free(SteamHttpConn *conn)
+{
+    b_event_remove(conn->ioid);
+    b_event_remove(conn->toid);
+
+    if (conn->dns != NULL)
+        conn->dns->conns = g_slist_remove(conn->dns->conns, conn);
+
+    if (conn->ssl != NULL)
+        ssl_disconnect(conn->ssl);
+    else if (conn->fd >= 0)
+        closesocket(conn->fd);
+
+    g_queue_remove(conn->pool->idle, conn);
+    conn->pool->size--;
+
+    if (conn->pool->warm == conn)
+        conn->pool->warm = NULL;
+
+    if (conn->body != NULL)
+        g_string_free(conn->body, TRUE);
+
+    g_string_free(conn->rbuf, TRUE);
+    g_free(conn->header);
+    g_free(conn);
+}
+
+static gboolean steam_http_pool_avail(SteamHttpPool *pool, SteamHttpPrio prio)
+{
+    guint max = STEAM_HTTP_POOL_MAX;
+
+    if (g_queue_get_length(pool->idle) > 0)
+        return TRUE;
+
+    /* Keep the last connection free for interactive requests */
+    if (prio > STEAM_HTTP_PRIO_SEND)
+        max--;
+
+    return pool->size < max;
+}
+
+static void steam_http_pool_next(SteamHttpPool *pool)
+{
+    SteamHttpReq *req;
+    guint         i;
+
+    for (i = 0; i < STEAM_HTTP_PRIO_LAST; i++) {
+        while ((req = g_queue_peek_head(pool->waitq[i])) != NULL) {
+            /* Anything behind is of the same or a lower class */
+            if (!steam_http_pool_avail(pool, i))
+                return;
+
+            steam_http_link_remove(pool->waitq[i], &req->wlink);
+            steam_http_req_sendasm(req);
+        }
+    }
+}
+
+static void steam_http_conn_error(SteamHttpConn *conn, const gchar *msg)
+{
+    SteamHttpPool *pool = conn->pool;
+    SteamHttpReq  *req  = conn->req;
+    gboolean       stale;
+
+    /* A pooled connection closed by the server while it was idle */
+    stale = (conn->reqs > 0) && !(conn->flags & STEAM_HTTP_CONN_FLAG_RECEIVED);
+
+    conn->req = NULL;
+    steam_http_conn_free(conn);
+
+    if (req == NULL) {
+        steam_http_pool_next(pool);
+        return;
+    }
+
+    req->conn = NULL;
+
+    /* The server may have acted on a POST, only repeat the safe ones */
+    if (stale && (!(req->flags & STEAM_HTTP_REQ_FLAG_POST) ||
+                  (req->flags & STEAM_HTTP_REQ_FLAG_IDEMP)))
+    {
+        steam_http_req_sendasm(req);
+        return;
+    }
+
+    steam_http_pool_next(pool);
+    g_set_error(&req->err, STEAM_HTTP_ERROR, 0, "%s", msg);
+    steam_http_req_done(req);
+}
+
+static gboolean steam_http_conn_idle_cb(gpointer data, gint fd,
+                                        b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+    gchar          buf;
+
+    conn->ioid = 0;
+
+    /* Post-handshake TLS records are consumed without any data */
+    if ((conn->ssl != NULL) && (ssl_read(conn->ssl, &buf, 1) < 0) &&
+        steam_http_conn_again(conn))
+    {
+        conn->ioid = b_input_add(conn->fd, steam_http_conn_dir(conn, cond),
+                                 steam_http_conn_idle_cb, conn);
+        return FALSE;
+    }
+
+    steam_http_conn_free(conn);
+    return FALSE;
+}
+
+static gboolean steam_http_conn_timeout_cb(gpointer data, gint fd,
+                                           b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+
+    conn->toid = 0;
+    steam_http_conn_free(conn);
+    return FALSE;
+}
+
+static void steam_http_pool_release(SteamHttpPool *pool, SteamHttpConn *conn)
+{
+    conn->ioid = b_input_add(conn->fd, B_EV_IO_READ,
+                             steam_http_conn_idle_cb, conn);
+    conn->toid = b_timeout_add(STEAM_HTTP_POOL_TIMEOUT,
+                               steam_http_conn_timeout_cb, conn);
+
+    /* Most recently used first, allowing the rest to expire */
+    g_queue_push_head(pool->idle, conn);
+}
+
+static GString *steam_http_inflate(SteamHttp *http, const GString *body,
+                                   gboolean deflate, GError **err)
+{
+    z_stream *zs = http->zstrm;
+    GString  *out;
+    gsize     size;
+    gint      bits;
+    gint      ret;
+
+    /* Detects both gzip and zlib wrapped streams */
+    bits = MAX_WBITS + 32;
+
+    if (zs == NULL) {
+        zs = g_new0(z_stream, 1);
+
+        if (inflateInit2(zs, bits) != Z_OK) {
+            g_free(zs);
+            g_set_error(err, STEAM_HTTP_ERROR, 0,
+                        "Failed to initialize decompression");
+            return NULL;
+        }
+
+        http->zstrm = zs;
+    }
+
+    out = g_string_sized_new(MAX(body->len * 4, STEAM_HTTP_INFLATE_SIZE));
+
+    while (TRUE) {
+        inflateReset2(zs, bits);
+        zs->next_in  = (Bytef *) body->str;
+        zs->avail_in = body->len;
+        size         = 0;
+
+        do {
+            /* Refuse to let a small body expand without bound */
+            if (size >= STEAM_HTTP_INFLATE_MAX) {
+                g_string_free(out, TRUE);
+                g_set_error(err, STEAM_HTTP_ERROR, 0,
+                            "Decoded response body is too large");
+                return NULL;
+            }
+
+            g_string_set_size(out, size + STEAM_HTTP_INFLATE_SIZE);
+            zs->next_out  = (Bytef *) out->str + size;
+            zs->avail_out = STEAM_HTTP_INFLATE_SIZE;
+
+            ret   = inflate(zs, Z_NO_FLUSH);
+            size += STEAM_HTTP_INFLATE_SIZE - zs->avail_out;
+        } while (ret == Z_OK);
+
+        if (ret == Z_STREAM_END)
+            break;
+
+        /* Some servers send "deflate" without the zlib wrapper */
+        if (!deflate || (bits < 0)) {
+            g_string_free(out, TRUE);
+            g_set_error(err, STEAM_HTTP_ERROR, 0,
+                        "Failed to decode response body");
+            return NULL;
+        }
+
+        bits = -MAX_WBITS;
+    }
+
+    g_string_truncate(out, size);
+    return out;
+}
+
+static void steam_http_conn_done(SteamHttpConn *conn)
+{
+    SteamHttpPool *pool = conn->pool;
+    SteamHttpReq  *req  = conn->req;
+    GString       *body;
+    GError        *err  = NULL;
+
+    if (conn->flags & (STEAM_HTTP_CONN_FLAG_GZIP |
+                       STEAM_HTTP_CONN_FLAG_DEFLATE))
+    {
+        body = steam_http_inflate(pool->http, conn->body,
+                                  conn->flags & STEAM_HTTP_CONN_FLAG_DEFLATE,
+                                  &err);
+
+        if (body == NULL) {
+            steam_http_conn_error(conn, err->message);
+            g_error_free(err);
+            return;
+        }
+
+        g_string_free(conn->body, TRUE);
+        conn->body = body;
+    }
+
+    req->status    = conn->status;
+    req->header    = conn->header;
+    req->body_size = conn->body->len;
+    req->body      = g_string_free(conn->body, FALSE);
+    req->conn      = NULL;
+
+    conn->req    = NULL;
+    conn->header = NULL;
+    conn->body   = NULL;
+    conn->flags &= STEAM_HTTP_CONN_FLAG_CONNECTED | STEAM_HTTP_CONN_FLAG_CLOSE;
+    conn->reqs++;
+
+    if (conn->flags & STEAM_HTTP_CONN_FLAG_CLOSE)
+        steam_http_conn_free(conn);
+    else
+        steam_http_pool_release(pool, conn);
+
+    steam_http_pool_next(pool);
+    steam_http_req_cb(req);
+}
+
+static gboolean steam_http_conn_headers(SteamHttpConn *conn)
+{
+    gchar  **hdrs;
+    gchar   *end;
+    gchar   *str;
+    gsize    size;
+    gsize    i;
+
+    end = g_strstr_len(conn->rbuf->str, conn->rbuf->len, "\r\n\r\n");
+
+    if (end == NULL)
+        return TRUE;
+
+    size = (end - conn->rbuf->str) + 4;
+    conn->header = g_strndup(conn->rbuf->str, size);
+    conn->body   = g_string_sized_new(conn->rbuf->len - size + 1);
+    conn->csize  = -1;
+    conn->flags |= STEAM_HTTP_CONN_FLAG_HEADERS;
+    g_string_erase(conn->rbuf, 0, size);
+
+    if (!g_str_has_prefix(conn->header, "HTTP/1.") ||
+        (strlen(conn->header) < 12))
+        return FALSE;
+
+    /* HTTP/1.0 is only persistent when requested */
+    if (conn->header[7] == '0')
+        conn->flags |= STEAM_HTTP_CONN_FLAG_CLOSE;
+
+    conn->status = g_ascii_strtoll(conn->header + 9, NULL, 10);
+    hdrs = g_strsplit(conn->header, "\r\n", 0);
+
+    for (i = 1; hdrs[i] != NULL; i++) {
+        str = strchr(hdrs[i], ':');
+
+        if (str == NULL)
+            continue;
+
+        *(str++) = 0;
+        str = g_strstrip(str);
+
+        if (g_ascii_strcasecmp(hdrs[i], "Content-Length") == 0) {
+            conn->csize = g_ascii_strtoll(str, NULL, 10);
+        } else if (g_ascii_strcasecmp(hdrs[i], "Transfer-Encoding") == 0) {
+            if (g_ascii_strcasecmp(str, "chunked") == 0)
+                conn->flags |= STEAM_HTTP_CONN_FLAG_CHUNKED;
+        } else if (g_ascii_strcasecmp(hdrs[i], "Connection") == 0) {
+            if (g_ascii_strcasecmp(str, "close") == 0)
+                conn->flags |= STEAM_HTTP_CONN_FLAG_CLOSE;
+            else if (g_ascii_strcasecmp(str, "keep-alive") == 0)
+                conn->flags &= ~STEAM_HTTP_CONN_FLAG_CLOSE;
+        } else if (g_ascii_strcasecmp(hdrs[i], "Content-Encoding") == 0) {
+            if (g_ascii_strcasecmp(str, "gzip") == 0)
+                conn->flags |= STEAM_HTTP_CONN_FLAG_GZIP;
+            else if (g_ascii_strcasecmp(str, "deflate") == 0)
+                conn->flags |= STEAM_HTTP_CONN_FLAG_DEFLATE;
+        }
+    }
+
+    g_strfreev(hdrs);
+
+    if ((conn->status / 100 == 1) || (conn->status == 204) ||
+        (conn->status == 304))
+    {
+        conn->csize  = 0;
+        conn->flags &= ~STEAM_HTTP_CONN_FLAG_CHUNKED;
+    } else if (conn->flags & STEAM_HTTP_CONN_FLAG_CHUNKED) {
+        conn->csize = -1;
+    } else if (conn->csize < 0) {
+        conn->flags |= STEAM_HTTP_CONN_FLAG_EOF | STEAM_HTTP_CONN_FLAG_CLOSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean steam_http_conn_chunked(SteamHttpConn *conn)
+{
+    gchar  *end;
+    gsize   size;
+    gsize   line;
+
+    while (conn->rbuf->len > 0) {
+        if (conn->csize > 0) {
+            size = MIN((gsize) conn->csize, conn->rbuf->len);
+            g_string_append_len(conn->body, conn->rbuf->str, size);
+            g_string_erase(conn->rbuf, 0, size);
+
+            if ((conn->csize -= size) > 0)
+                return TRUE;
+
+            /* Await the line ending which follows the chunk data */
+            conn->csize = -2;
+        }
+
+        end = g_strstr_len(conn->rbuf->str, conn->rbuf->len, "\r\n");
+
+        if (end == NULL)
+            return TRUE;
+
+        line = end - conn->rbuf->str;
+
+        if (conn->flags & STEAM_HTTP_CONN_FLAG_TRAILER) {
+            g_string_erase(conn->rbuf, 0, line + 2);
+
+            if (line == 0) {
+                conn->csize = 0;
+                return TRUE;
+            }
+
+            continue;
+        }
+
+        if (conn->csize == -2) {
+            g_string_erase(conn->rbuf, 0, line + 2);
+            conn->csize = -1;
+            continue;
+        }
+
+        conn->csize = g_ascii_strtoll(conn->rbuf->str, NULL, 16);
+        g_string_erase(conn->rbuf, 0, line + 2);
+
+        if (conn->csize < 0)
+            return FALSE;
+
+        if (conn->csize == 0) {
+            conn->csize  = -1;
+            conn->flags |= STEAM_HTTP_CONN_FLAG_TRAILER;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean steam_http_conn_parse(SteamHttpConn *conn, gboolean *done)
+{
+    *done = FALSE;
+
+    if (!(conn->flags & STEAM_HTTP_CONN_FLAG_HEADERS)) {
+        if (!steam_http_conn_headers(conn))
+            return FALSE;
+
+        if (!(conn->flags & STEAM_HTTP_CONN_FLAG_HEADERS))
+            return TRUE;
+    }
+
+    if (conn->flags & STEAM_HTTP_CONN_FLAG_CHUNKED) {
+        if (!steam_http_conn_chunked(conn))
+            return FALSE;
+
+        *done = (conn->csize == 0);
+        return TRUE;
+    }
+
+    g_string_append_len(conn->body, conn->rbuf->str, conn->rbuf->len);
+    g_string_truncate(conn->rbuf, 0);
+
+    if ((conn->csize < 0) || (conn->body->len < (gsize) conn->csize))
+        return TRUE;
+
+    /* Nothing is pipelined, trailing data spoils the connection */
+    if (conn->body->len > (gsize) conn->csize) {
+        g_string_truncate(conn->body, conn->csize);
+        conn->flags |= STEAM_HTTP_CONN_FLAG_CLOSE;
+    }
+
+    *done = TRUE;
+    return TRUE;
+}
+
+static gboolean steam_http_conn_read_cb(gpointer data, gint fd,
+                                        b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+    gchar          buf[4096];
+    gssize         size;
+    gboolean       done;
+
+    conn->ioid = 0;
+
+    for (;;) {
+        if (conn->ssl != NULL)
+            size = ssl_read(conn->ssl, buf, sizeof buf);
+        else
+            size = read(conn->fd, buf, sizeof buf);
+
+        if ((size < 0) && steam_http_conn_again(conn))
+            break;
+
+        if (size < 0) {
+            steam_http_conn_error(conn, "Failed to read reply");
+            return FALSE;
+        }
+
+        if (size == 0) {
+            if (conn->flags & STEAM_HTTP_CONN_FLAG_EOF) {
+                conn->flags |= STEAM_HTTP_CONN_FLAG_CLOSE;
+                steam_http_conn_done(conn);
+            } else {
+                steam_http_conn_error(conn, "Connection closed");
+            }
+
+            return FALSE;
+        }
+
+        if (!(conn->flags & STEAM_HTTP_CONN_FLAG_RECEIVED))
+            steam_http_req_mark(conn->req, STEAM_HTTP_MARK_FIRST);
+
+        conn->flags |= STEAM_HTTP_CONN_FLAG_RECEIVED;
+        g_string_append_len(conn->rbuf, buf, size);
+
+        if (!steam_http_conn_parse(conn, &done)) {
+            steam_http_conn_error(conn, "Malformed reply");
+            return FALSE;
+        }
+
+        if (done) {
+            steam_http_conn_done(conn);
+            return FALSE;
+        }
+    }
+
+    conn->ioid = b_input_add(conn->fd, steam_http_conn_dir(conn, cond),
+                             steam_http_conn_read_cb, conn);
+    return FALSE;
+}
+
+static gboolean steam_http_conn_write_cb(gpointer data, gint fd,
+                                         b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+    gssize         size;
+
+    conn->ioid = 0;
+    size = conn->wsize - conn->wpos;
+
+    if (conn->ssl != NULL)
+        size = ssl_write(conn->ssl, conn->wbuf + conn->wpos, size);
+    else
+        size = write(conn->fd, conn->wbuf + conn->wpos, size);
+
+    if (size > 0) {
+        conn->wpos += size;
+    } else if ((size == 0) || !steam_http_conn_again(conn)) {
+        steam_http_conn_error(conn, "Failed to write request");
+        return FALSE;
+    }
+
+    if (conn->wpos < conn->wsize) {
+        conn->ioid = b_input_add(conn->fd,
+                                 steam_http_conn_dir(conn, B_EV_IO_WRITE),
+                                 steam_http_conn_write_cb, conn);
+        return FALSE;
+    }
+
+    conn->wbuf = NULL;
+    conn->ioid = b_input_add(conn->fd, B_EV_IO_READ,
+                             steam_http_conn_read_cb, conn);
+    return FALSE;
+}
+
+static void steam_http_conn_connected(SteamHttpConn *conn)
+{
+    SteamHttpReq *req = conn->req;
+
+    conn->flags |= STEAM_HTTP_CONN_FLAG_CONNECTED;
+
+    /* Plain connections skip the handshake, SSL ones hide the connect */
+    if ((req != NULL) && (req->marks != NULL)) {
+        if (req->marks[STEAM_HTTP_MARK_CONNECT] == 0)
+            req->marks[STEAM_HTTP_MARK_CONNECT] =
+                req->marks[STEAM_HTTP_MARK_TLS];
+
+        if (req->marks[STEAM_HTTP_MARK_TLS] == 0)
+            req->marks[STEAM_HTTP_MARK_TLS] =
+                req->marks[STEAM_HTTP_MARK_CONNECT];
+    }
+
+    if (conn->pool->warm == conn)
+        conn->pool->warm = NULL;
+
+    if (conn->req == NULL) {
+        steam_http_pool_release(conn->pool, conn);
+        steam_http_pool_next(conn->pool);
+        return;
+    }
+
+    conn->ioid = b_input_add(conn->fd, B_EV_IO_WRITE,
+                             steam_http_conn_write_cb, conn);
+}
+
+static gboolean steam_http_conn_ssl_cb(gpointer data, gint error,
+                                       gpointer ssl, b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+
+    if (ssl == NULL) {
+        conn->ssl = NULL;
+        conn->fd  = -1;
+        steam_http_conn_error(conn, "Failed to establish SSL connection");
+        return FALSE;
+    }
+
+    conn->fd = ssl_getfd(ssl);
+    steam_http_req_mark(conn->req, STEAM_HTTP_MARK_TLS);
+    steam_http_conn_connected(conn);
+    return FALSE;
+}
+
+static gboolean steam_http_conn_connect_cb(gpointer data, gint fd,
+                                           b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+
+    if (fd < 0) {
+        conn->fd = -1;
+        steam_http_conn_error(conn, "Failed to connect");
+        return FALSE;
+    }
+
+    conn->fd = fd;
+    steam_http_req_mark(conn->req, STEAM_HTTP_MARK_CONNECT);
+
+    if (!conn->pool->ssl) {
+        steam_http_conn_connected(conn);
+        return FALSE;
+    }
+
+    /* Connected by address, the name is still needed for verification */
+    conn->ssl = ssl_starttls(fd, conn->pool->host, TRUE,
+                             steam_http_conn_ssl_cb, conn);
+
+    if (conn->ssl == NULL)
+        steam_http_conn_error(conn, "Failed to establish SSL connection");
+
+    return FALSE;
+}
+
+static gboolean steam_http_conn_fail_cb(gpointer data, gint fd,
+                                        b_input_condition cond)
+{
+    SteamHttpConn *conn = data;
+
+    conn->toid = 0;
+    steam_http_conn_error(conn, "Failed to init connection");
+    return FALSE;
+}
+
+static void steam_http_conn_open(SteamHttpConn *conn, const gchar *addr)
+{
+    if (addr != NULL) {
+        conn->fd = proxy_connect(addr, conn->pool->port,
+                                 steam_http_conn_connect_cb, conn);
+
+        if (conn->fd >= 0)
+            return;
+    }
+
+    /* Report the failure once the caller has let go */
+    conn->toid = b_timeout_add(0, steam_http_conn_fail_cb, conn);
+}
+
+static gpointer steam_http_dns_thread(gpointer data)
+{
+    SteamHttpDnsJob *job = data;
+    struct addrinfo  hints;
+    struct addrinfo *ai;
+    gchar            buf[NI_MAXHOST];
+    gssize           ret;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(job->host, NULL, &hints, &ai) == 0) {
+        if (getnameinfo(ai->ai_addr, ai->ai_addrlen, buf, sizeof buf,
+                        NULL, 0, NI_NUMERICHOST) == 0)
+        {
+            job->addr = g_strdup(buf);
+        }
+
+        freeaddrinfo(ai);
+    }
+
+    /* Pointer sized writes to a pipe are atomic, and the write end
+     * blocks, so the main loop always hears back about the job */
+    do {
+        ret = write(job->fd, &job, sizeof job);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret != sizeof job) {
+        g_free(job->addr);
+        g_free(job->host);
+        g_free(job);
+    }
+
+    return NULL;
+}
+
+static gboolean steam_http_dns_usable(SteamHttpDns *dns)
+{
+    return (dns->addr != NULL) &&
+           ((g_get_monotonic_time() - dns->stamp) <
+            (STEAM_HTTP_DNS_TTL * 1000));
+}
+
+static gboolean steam_http_dns_cb(gpointer data, gint fd,
+                                  b_input_condition cond)
+{
+    SteamHttpDnsJob *job;
+    SteamHttpConn   *conn;
+    SteamHttpDns    *dns;
+
+    while (read(fd, &job, sizeof job) == sizeof job) {
+        dns = g_hash_table_lookup(steam_http_dns, job->host);
+
+        if (dns == NULL)
+            goto next;
+
+        dns->busy = FALSE;
+
+        /* A failed refresh keeps the previous address until it expires */
+        if (job->addr != NULL) {
+            g_free(dns->addr);
+            dns->addr  = job->addr;
+            dns->stamp = g_get_monotonic_time();
+            job->addr  = NULL;
+        }
+
+        /* Stop should a failure callback have started another lookup */
+        while ((dns->conns != NULL) && !dns->busy) {
+            conn = dns->conns->data;
+            conn->dns  = NULL;
+            dns->conns = g_slist_delete_link(dns->conns, dns->conns);
+
+            steam_http_conn_open(conn, steam_http_dns_usable(dns) ?
+                                       dns->addr : NULL);
+        }
+
+next:
+        g_free(job->addr);
+        g_free(job->host);
+        g_free(job);
+    }
+
+    return TRUE;
+}
 
-static void steam_http_req_queue(SteamHttp *http, gboolean force);
+static void steam_http_dns_free(SteamHttpDns *dns)
+{
+    g_slist_free(dns->conns);
+    g_free(dns->addr);
+    g_free(dns->host);
+    g_free(dns);
+}
 
-static void steam_http_tree_ins(GTree *tree, SteamHttpPair *pair, va_list ap)
+static GSList *steam_http_dns_reset(void)
 {
-    SteamHttpPair *p;
-    gchar         *key;
-    gchar         *val;
+    GHashTableIter  iter;
+    SteamHttpDns   *dns;
+    GSList         *conns;
+    GSList         *l;
+
+    if (steam_http_dns_ev > 0) {
+        b_event_remove(steam_http_dns_ev);
+        steam_http_dns_ev = 0;
+    }
 
-    for (p = pair; p != NULL; ) {
-        if (p->key == NULL)
-            continue;
+    if (steam_http_dns_fds[0] >= 0) {
+        close(steam_http_dns_fds[0]);
+        close(steam_http_dns_fds[1]);
+
+        steam_http_dns_fds[0] = -1;
+        steam_http_dns_fds[1] = -1;
+    }
 
-        key = g_strdup(p->key);
-        val = g_strdup(p->val);
+    conns = NULL;
+    g_hash_table_iter_init(&iter, steam_http_dns);
 
-        g_tree_replace(tree, key, val);
-        p = va_arg(ap, SteamHttpPair*);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &dns)) {
+        conns = g_slist_concat(conns, dns->conns);
+        dns->conns = NULL;
     }
+
+    for (l = conns; l != NULL; l = l->next)
+        ((SteamHttpConn *) l->data)->dns = NULL;
+
+    g_hash_table_destroy(steam_http_dns);
+    steam_http_dns = NULL;
+    return conns;
 }
 
-GQuark steam_http_error_quark(void)
+static void steam_http_dns_init(void)
 {
-    static GQuark q;
+    SteamHttpConn *conn;
+    GSList        *conns;
 
-    if (G_UNLIKELY(q == 0))
-        q = g_quark_from_static_string("steam-http-error-quark");
+    conns = NULL;
 
-    return q;
+    /* Resolver threads do not survive a fork, start over in the child */
+    if ((steam_http_dns != NULL) && (steam_http_dns_pid != getpid()))
+        conns = steam_http_dns_reset();
+
+    if (steam_http_dns == NULL) {
+        steam_http_dns     = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                 NULL, (GDestroyNotify) steam_http_dns_free);
+        steam_http_dns_pid = getpid();
+    }
+
+    /* Tried again on every lookup until there is a resolver */
+    if (steam_http_dns_fds[0] < 0) {
+        if (pipe(steam_http_dns_fds) == 0) {
+            sock_make_nonblocking(steam_http_dns_fds[0]);
+            steam_http_dns_ev = b_input_add(steam_http_dns_fds[0],
+                                            B_EV_IO_READ,
+                                            steam_http_dns_cb, NULL);
+        } else {
+            steam_http_dns_fds[0] = -1;
+            steam_http_dns_fds[1] = -1;
+        }
+    }
+
+    /* The lookups they waited on died with the parent's threads */
+    while (conns != NULL) {
+        conn  = conns->data;
+        conns = g_slist_delete_link(conns, conns);
+        steam_http_conn_resolve(conn);
+    }
+}
+
+static SteamHttpDns *steam_http_dns_lookup(const gchar *host)
+{
+    SteamHttpDnsJob *job;
+    SteamHttpDns    *dns;
+    gint64           age;
+
+    steam_http_dns_init();
+    dns = g_hash_table_lookup(steam_http_dns, host);
+
+    if (dns == NULL) {
+        dns = g_new0(SteamHttpDns, 1);
+        dns->host = g_strdup(host);
+        g_hash_table_insert(steam_http_dns, dns->host, dns);
+    }
+
+    age = g_get_monotonic_time() - dns->stamp;
+
+    /* Refresh ahead of expiry, connections keep the old address meanwhile */
+    if (dns->busy || (steam_http_dns_fds[1] < 0) ||
+        ((dns->addr != NULL) && (age < (STEAM_HTTP_DNS_REFRESH * 1000))))
+    {
+        return dns;
+    }
+
+    job = g_new0(SteamHttpDnsJob, 1);
+    job->host = g_strdup(host);
+    job->fd   = steam_http_dns_fds[1];
+
+    dns->busy = TRUE;
+    g_thread_unref(g_thread_new("steam-dns", steam_http_dns_thread, job));
+    return dns;
+}
+
+void steam_http_dns_prefetch(const gchar *host)
+{
+    g_return_if_fail(host != NULL);
+
+    if (proxytype == 0)
+        steam_http_dns_lookup(host);
+}
+
+static void steam_http_conn_resolve(SteamHttpConn *conn)
+{
+    SteamHttpDns *dns;
+
+    /* The proxy is handed the name, it may well resolve it remotely */
+    if (proxytype != 0) {
+        steam_http_conn_open(conn, conn->pool->host);
+        return;
+    }
+
+    dns = steam_http_dns_lookup(conn->pool->host);
+
+    if (steam_http_dns_usable(dns)) {
+        steam_http_conn_open(conn, dns->addr);
+    } else if (dns->busy) {
+        conn->dns  = dns;
+        dns->conns = g_slist_append(dns->conns, conn);
+    } else {
+        /* Never resolved in place, that would block the main loop */
+        steam_http_conn_open(conn, NULL);
+    }
+}
+
+static SteamHttpConn *steam_http_conn_new(SteamHttpPool *pool)
+{
+    SteamHttpConn *conn;
+
+    conn = g_new0(SteamHttpConn, 1);
+
+    conn->pool = pool;
+    conn->fd   = -1;
+    conn->rbuf = g_string_sized_new(4096);
+    pool->size++;
+
+    steam_http_conn_resolve(conn);
+    return conn;
+}
+
+static SteamHttpConn *steam_http_pool_conn(SteamHttpPool *pool,
+                                           SteamHttpPrio prio)
+{
+    SteamHttpConn *conn;
+
+    conn = g_queue_pop_head(pool->idle);
+
+    if (conn != NULL) {
+        b_event_remove(conn->ioid);
+        b_event_remove(conn->toid);
+
+        conn->ioid = 0;
+        conn->toid = 0;
+        return conn;
+    }
+
+    /* Still connecting, but the handshake is already under way */
+    if (pool->warm != NULL) {
+        conn = pool->warm;
+        pool->warm = NULL;
+        return conn;
+    }
+
+    if (!steam_http_pool_avail(pool, prio))
+        return NULL;
+
+    return steam_http_conn_new(pool);
+}
+
+static void steam_http_pool_warm(SteamHttpPool *pool)
+{
+    if ((pool->warm != NULL) || (g_queue_get_length(pool->idle) > 0) ||
+        !steam_http_pool_avail(pool, STEAM_HTTP_PRIO_SEND))
+    {
+        return;
+    }
+
+    pool->warm = steam_http_conn_new(pool);
+}
+
+static void steam_http_conn_send(SteamHttpConn *conn, SteamHttpReq *req)
+{
+    conn->req   = req;
+    conn->wbuf  = req->sbuf->str;
+    conn->wsize = req->sbuf->len;
+    conn->wpos  = 0;
+    req->conn   = conn;
+
+    if (!(conn->flags & STEAM_HTTP_CONN_FLAG_CONNECTED))
+        return;
+
+    conn->ioid = b_input_add(conn->fd, B_EV_IO_WRITE,
+                             steam_http_conn_write_cb, conn);
+}
+
+static void steam_http_lane_push(SteamHttp *http, SteamHttpReq *req)
+{
+    SteamHttpLane *lane;
+    const gchar   *key;
+
+    key  = (req->lane != NULL) ? req->lane : "";
+    lane = g_hash_table_lookup(http->lanes, key);
+
+    if (lane == NULL) {
+        lane = g_new0(SteamHttpLane, 1);
+        lane->key  = g_strdup(key);
+        lane->reqq = g_queue_new();
+
+        g_hash_table_insert(http->lanes, lane->key, lane);
+    }
+
+    /* A resent request keeps its place ahead of the conversation */
+    steam_http_link_push(lane->reqq, &req->llink, req,
+                         req->flags & STEAM_HTTP_REQ_FLAG_RESEND);
+
+    if ((lane->req != NULL) || (lane->qlink.data != NULL))
+        return;
+
+    steam_http_link_push(http->laneq, &lane->qlink, lane,
+                         req->flags & STEAM_HTTP_REQ_FLAG_RESEND);
+}
+
+static gboolean steam_http_lane_remove(SteamHttp *http, SteamHttpReq *req)
+{
+    SteamHttpLane *lane;
+    const gchar   *key;
+    gboolean       freed;
+
+    key  = (req->lane != NULL) ? req->lane : "";
+    lane = g_hash_table_lookup(http->lanes, key);
+
+    if ((lane == NULL) || !steam_http_link_remove(lane->reqq, &req->llink))
+        return FALSE;
+
+    freed = (lane->req == req);
+
+    if (freed) {
+        lane->req = NULL;
+        http->lanes_busy--;
+
+        if (!g_queue_is_empty(lane->reqq))
+            steam_http_link_push(http->laneq, &lane->qlink, lane, FALSE);
+    }
+
+    if (!g_queue_is_empty(lane->reqq))
+        return freed;
+
+    steam_http_link_remove(http->laneq, &lane->qlink);
+    g_hash_table_remove(http->lanes, lane->key);
+
+    g_queue_free(lane->reqq);
+    g_free(lane->key);
+    g_free(lane);
+    return freed;
 }
 
 SteamHttp *steam_http_new(const gchar *agent)
@@ -61,10 +1288,26 @@ SteamHttp *steam_http_new(const gchar *agent)
 
     http = g_new0(SteamHttp, 1);
 
-    http->agent   = g_strdup(agent);
-    http->reqq    = g_queue_new();
-    http->cookies = g_tree_new_full((GCompareDataFunc) g_ascii_strcasecmp,
-                                    NULL, g_free, g_free);
+    http->agent     = g_strdup(agent);
+    http->reqq      = g_queue_new();
+    http->reqs      = g_hash_table_new(g_direct_hash, g_direct_equal);
+    http->cookies   = g_tree_new_full((GCompareDataFunc) g_ascii_strcasecmp,
+                                      NULL, g_free, g_free);
+    http->cookiehdr = g_string_sized_new(128);
+    http->pools     = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)
+                                            steam_http_pool_free);
+    http->lanes     = g_hash_table_new(g_str_hash, g_str_equal);
+    http->inflight  = g_hash_table_new(g_str_hash, g_str_equal);
+    http->laneq     = g_queue_new();
+
+    http->paces     = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            NULL, g_free);
+
+    http->lanes_max = STEAM_HTTP_LANES_MAX;
+    http->prate     = STEAM_HTTP_PACE_RATE;
+    http->pburst    = STEAM_HTTP_PACE_BURST;
+    http->rbudget   = STEAM_HTTP_RETRY_BUDGET * STEAM_HTTP_RETRY_RATIO;
     return http;
 }
 
@@ -74,10 +1317,13 @@ void steam_http_free_reqs(SteamHttp *http)
 
     g_return_if_fail(http != NULL);
 
-    http->flags &= ~STEAM_HTTP_FLAG_QUEUED;
+    /* Nothing is dispatched in place of the requests being freed */
+    http->flags |= STEAM_HTTP_FLAG_CLEARING;
 
-    while ((req = g_queue_pop_tail(http->reqq)) != NULL)
+    while ((req = g_queue_peek_tail(http->reqq)) != NULL)
         steam_http_req_free(req);
+
+    http->flags &= ~STEAM_HTTP_FLAG_CLEARING;
 }
 
 void steam_http_free(SteamHttp *http)
@@ -85,8 +1331,26 @@ void steam_http_free(SteamHttp *http)
     g_return_if_fail(http != NULL);
 
     steam_http_free_reqs(http);
+    steam_http_transport_set(http, NULL, NULL);
+    g_hash_table_destroy(http->lanes);
+    g_hash_table_destroy(http->inflight);
+    g_hash_table_destroy(http->paces);
+
+    if (http->stats != NULL)
+        g_hash_table_destroy(http->stats);
+
+    g_free(http->trace);
+    g_queue_free(http->laneq);
+    g_hash_table_destroy(http->pools);
     g_queue_free(http->reqq);
+    g_hash_table_destroy(http->reqs);
     g_tree_destroy(http->cookies);
+    g_string_free(http->cookiehdr, TRUE);
+
+    if (http->zstrm != NULL) {
+        inflateEnd(http->zstrm);
+        g_free(http->zstrm);
+    }
 
     g_free(http->agent);
     g_free(http);
@@ -98,20 +1362,370 @@ void steam_http_queue_pause(SteamHttp *http, gboolean pause)
 
     if (!pause) {
         http->flags &= ~STEAM_HTTP_FLAG_PAUSED;
-        steam_http_req_queue(http, TRUE);
+        steam_http_req_queue(http);
     } else {
         http->flags |= STEAM_HTTP_FLAG_PAUSED;
     }
 }
 
+void steam_http_queue_lanes(SteamHttp *http, guint lanes)
+{
+    g_return_if_fail(http != NULL);
+
+    http->lanes_max = MAX(lanes, 1);
+    steam_http_req_queue(http);
+}
+
+void steam_http_pace_host(SteamHttp *http, gdouble rate, guint burst)
+{
+    GHashTableIter  iter;
+    SteamHttpPool  *pool;
+
+    g_return_if_fail(http != NULL);
+
+    http->prate  = rate;
+    http->pburst = burst;
+    g_hash_table_iter_init(&iter, http->pools);
+
+    /* Accumulated tokens and slowdowns carry over */
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &pool)) {
+        pool->bucket.rate  = rate;
+        pool->bucket.burst = MAX(burst, 1);
+    }
+}
+
+void steam_http_pace_set(SteamHttp *http, gint stat, gdouble rate,
+                         guint burst)
+{
+    SteamHttpBucket *bkt;
+
+    g_return_if_fail(http != NULL);
+
+    if (rate <= 0) {
+        g_hash_table_remove(http->paces, GINT_TO_POINTER(stat));
+        return;
+    }
+
+    bkt = g_new0(SteamHttpBucket, 1);
+    steam_http_bucket_init(bkt, rate, burst);
+    g_hash_table_replace(http->paces, GINT_TO_POINTER(stat), bkt);
+}
+
+void steam_http_stats_enable(SteamHttp *http, gboolean enable)
+{
+    g_return_if_fail(http != NULL);
+
+    if (enable && (http->stats == NULL)) {
+        http->stats = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            NULL, g_free);
+    } else if (!enable && (http->stats != NULL)) {
+        g_hash_table_destroy(http->stats);
+        http->stats = NULL;
+    }
+}
+
+const SteamHttpStats *steam_http_stats_get(SteamHttp *http, gint stat)
+{
+    g_return_val_if_fail(http != NULL, NULL);
+
+    if (http->stats == NULL)
+        return NULL;
+
+    return g_hash_table_lookup(http->stats, GINT_TO_POINTER(stat));
+}
+
+void steam_http_transport_set(SteamHttp *http,
+                              const SteamHttpTransport *tport,
+                              gpointer data)
+{
+    g_return_if_fail(http != NULL);
+
+    if ((http->tport != NULL) && (http->tport->free != NULL))
+        http->tport->free(http->tpdata);
+
+    http->tport  = tport;
+    http->tpdata = data;
+}
+
+void steam_http_trace_set(SteamHttp *http, gboolean enable,
+                          SteamHttpTraceFunc func, gpointer data)
+{
+    g_return_if_fail(http != NULL);
+
+    http->tfunc = func;
+    http->tdata = data;
+
+    if (enable && (http->trace == NULL)) {
+        http->trace = g_new0(SteamHttpTrace, 1);
+    } else if (!enable) {
+        g_free(http->trace);
+        http->trace = NULL;
+    }
+}
+
+static gboolean steam_http_trace_match(const gchar *data, gsize size,
+                                       gsize pos, const gchar *str)
+{
+    gsize len;
+
+    len = strlen(str);
+    return ((size - pos) >= len) &&
+           (g_ascii_strncasecmp(data + pos, str, len) == 0);
+}
+
+void steam_http_trace_redact(gchar *data, gsize size)
+{
+    static const gchar *hdrs[] = {"Cookie:", "Set-Cookie:", NULL};
+    static const gchar *keys[] = {
+        "auth", "emailauth", "password", "sessionid", "steamLogin",
+        "steamLoginSecure", "token", "access_token", "oauth_token",
+        "token_secure", "webcookie", NULL
+    };
+
+    const gchar **s;
+    gsize         i;
+    gsize         j;
+
+    g_return_if_fail(data != NULL);
+
+    /* Credentials never reach the ring, it is shown on the IRC side */
+    for (i = 0; i < size; i++) {
+        if ((i == 0) || (data[i - 1] == '\n')) {
+            for (s = hdrs; *s != NULL; s++) {
+                if (!steam_http_trace_match(data, size, i, *s))
+                    continue;
+
+                for (j = i + strlen(*s); (j < size) && (data[j] != '\r') &&
+                     (data[j] != '\n'); j++)
+                {
+                    data[j] = '*';
+                }
+            }
+        }
+
+        if ((i > 0) && (g_ascii_isalnum(data[i - 1]) || (data[i - 1] == '_')))
+            continue;
+
+        for (s = keys; *s != NULL; s++) {
+            j = i + strlen(*s);
+
+            if (!steam_http_trace_match(data, size, i, *s) || (j >= size) ||
+                (strchr("\"\\=:", data[j]) == NULL))
+            {
+                continue;
+            }
+
+            /* Form values end at '&', JSON ones at a possibly escaped quote */
+            while ((j < size) && (strchr("\"\\=: ", data[j]) != NULL))
+                j++;
+
+            for (; (j < size) && (strchr("&\"\\\r\n ,;}", data[j]) == NULL);
+                 j++)
+            {
+                data[j] = '*';
+            }
+        }
+    }
+}
+
+static void steam_http_trace_add(SteamHttpReq *req, SteamHttpTraceType type,
+                                 gint status, const gchar *head, gsize hsize,
+                                 const gchar *body, gsize bsize)
+{
+    SteamHttpTrace    *trace = req->http->trace;
+    SteamHttpTraceRec *rec;
+
+    if (G_LIKELY(trace == NULL))
+        return;
+
+    rec = &trace->recs[trace->next];
+    trace->next = (trace->next + 1) % STEAM_HTTP_TRACE_SIZE;
+    trace->count++;
+
+    rec->time   = g_get_monotonic_time();
+    rec->id     = req->id;
+    rec->type   = type;
+    rec->status = status;
+    rec->total  = hsize + bsize;
+    rec->hsize  = MIN(hsize, STEAM_HTTP_TRACE_DATA);
+    rec->size   = MIN(hsize + bsize, STEAM_HTTP_TRACE_DATA);
+
+    memcpy(rec->data, head, rec->hsize);
+
+    if (rec->size > rec->hsize)
+        memcpy(rec->data + rec->hsize, body, rec->size - rec->hsize);
+
+    steam_http_trace_redact(rec->data, rec->size);
+}
+
+static void steam_http_trace_reply(SteamHttpReq *req)
+{
+    gsize hsize;
+
+    if (G_LIKELY(req->http->trace == NULL))
+        return;
+
+    /* Keep room for the start of the body after large headers */
+    hsize = MIN(strlen(req->header), STEAM_HTTP_TRACE_DATA / 2);
+    steam_http_trace_add(req, STEAM_HTTP_TRACE_TYPE_REPLY, req->status,
+                         req->header, hsize, req->body, req->body_size);
+}
+
+void steam_http_trace_dump(SteamHttp *http, guint id, SteamHttpTraceFunc func,
+                           gpointer data)
+{
+    static const gchar *types = "><!";
+
+    SteamHttpTraceRec *rec;
+    GString           *gstr;
+    gint64             now;
+    gchar             *str;
+    guint              size;
+    guint              i;
+
+    g_return_if_fail(http != NULL);
+    g_return_if_fail(func != NULL);
+
+    if (http->trace == NULL)
+        return;
+
+    now  = g_get_monotonic_time();
+    size = MIN(http->trace->count, STEAM_HTTP_TRACE_SIZE);
+    gstr = g_string_sized_new(STEAM_HTTP_TRACE_DATA * 2);
+
+    /* Oldest first, optionally limited to a single request */
+    for (i = 0; i < size; i++) {
+        rec = &http->trace->recs[(http->trace->next + STEAM_HTTP_TRACE_SIZE -
+                                  size + i) % STEAM_HTTP_TRACE_SIZE];
+
+        if ((id != 0) && (rec->id != id))
+            continue;
+
+        str = g_strndup(rec->data, rec->size);
+        g_string_printf(gstr, "-%.3fs #%u %c %d %s",
+                        (now - rec->time) / (gdouble) G_USEC_PER_SEC,
+                        rec->id, types[rec->type], rec->status, str);
+        g_free(str);
+
+        if (rec->total > rec->size) {
+            g_string_append_printf(gstr, " [+%u bytes]",
+                                   rec->total - rec->size);
+        }
+
+        str = g_strescape(gstr->str, NULL);
+        func(str, data);
+        g_free(str);
+    }
+
+    g_string_free(gstr, TRUE);
+}
+
+/* Log-linear buckets: 16 per power of two, within ~6% of the value */
+static guint steam_http_hist_index(gint64 value)
+{
+    guint bits;
+    guint idx;
+
+    if (value < 32)
+        return MAX(value, 0);
+
+    bits = g_bit_storage(value) - 5;
+    idx  = (bits * 16) + (value >> bits);
+    return MIN(idx, STEAM_HTTP_HIST_SIZE - 1);
+}
+
+static gint64 steam_http_hist_value(guint idx)
+{
+    guint bits;
+
+    if (idx < 32)
+        return idx;
+
+    bits = (idx / 16) - 1;
+    return ((gint64) (idx % 16) + 16) << bits;
+}
+
+gint64 steam_http_hist_pct(const SteamHttpHist *hist, gdouble pct)
+{
+    guint64 count;
+    guint64 want;
+    guint   i;
+
+    g_return_val_if_fail(hist != NULL, 0);
+
+    if (hist->count < 1)
+        return 0;
+
+    want  = MAX((guint64) (hist->count * pct / 100.0 + 0.5), 1);
+    count = 0;
+
+    for (i = 0; i < STEAM_HTTP_HIST_SIZE; i++) {
+        count += hist->buckets[i];
+
+        /* Report the highest value the bucket stands for */
+        if (count >= want)
+            return steam_http_hist_value(i + 1) - 1;
+    }
+
+    return steam_http_hist_value(STEAM_HTTP_HIST_SIZE - 1);
+}
+
+static void steam_http_hist_add(SteamHttpHist *hist, gint64 value)
+{
+    hist->buckets[steam_http_hist_index(value)]++;
+    hist->count++;
+}
+
+static void steam_http_stats_add(SteamHttp *http, SteamHttpReq *req)
+{
+    SteamHttpStats *stats;
+    gint64         *m = req->marks;
+    guint           i;
+
+    if ((http->stats == NULL) || (m == NULL) ||
+        (m[STEAM_HTTP_MARK_DONE] == 0))
+        return;
+
+    stats = g_hash_table_lookup(http->stats, GINT_TO_POINTER(req->stat));
+
+    if (stats == NULL) {
+        stats = g_new0(SteamHttpStats, 1);
+        g_hash_table_insert(http->stats, GINT_TO_POINTER(req->stat), stats);
+    }
+
+    steam_http_hist_add(&stats->hists[0], m[STEAM_HTTP_MARK_DONE] -
+                                          m[STEAM_HTTP_MARK_ENQUEUE]);
+
+    for (i = 1; i < STEAM_HTTP_MARK_LAST; i++) {
+        if ((m[i - 1] != 0) && (m[i] != 0))
+            steam_http_hist_add(&stats->hists[i], m[i] - m[i - 1]);
+    }
+}
+
 void steam_http_cookies_set(SteamHttp *http, SteamHttpPair *pair, ...)
 {
-    va_list ap;
+    SteamHttpPair *p;
+    gpointer       key;
+    gpointer       val;
+    va_list        ap;
 
     g_return_if_fail(http != NULL);
 
     va_start(ap, pair);
-    steam_http_tree_ins(http->cookies, pair, ap);
+
+    for (p = pair; p != NULL; p = va_arg(ap, SteamHttpPair*)) {
+        if (p->key == NULL)
+            continue;
+
+        /* Only bump the generation when the jar actually changes */
+        if (g_tree_lookup_extended(http->cookies, p->key, &key, &val) &&
+            (g_strcmp0(val, p->val) == 0))
+            continue;
+
+        g_tree_replace(http->cookies, g_strdup(p->key), g_strdup(p->val));
+        http->cookiegen++;
+    }
+
     va_end(ap);
 }
 
@@ -126,10 +1740,10 @@ void steam_http_cookies_parse_req(SteamHttp *http, SteamHttpReq *req)
     g_return_if_fail(http != NULL);
     g_return_if_fail(req  != NULL);
 
-    if (req->request == NULL)
+    if (req->header == NULL)
         return;
 
-    hdrs = g_strsplit(req->request->reply_headers, "\r\n", 0);
+    hdrs = g_strsplit(req->header, "\r\n", 0);
 
     for (i = 0; hdrs[i] != NULL; i++) {
         if (g_ascii_strncasecmp(hdrs[i], "Set-Cookie", 10) != 0)
@@ -137,7 +1751,7 @@ void steam_http_cookies_parse_req(SteamHttp *http, SteamHttpReq *req)
 
         str = strchr(hdrs[i], ';');
 
-        if (str != NULL);
+        if (str != NULL)
             str[0] = 0;
 
         str = strchr(hdrs[i], ':');
@@ -197,32 +1811,51 @@ void steam_http_cookies_parse_str(SteamHttp *http, const gchar *data)
 
 static gboolean steam_http_tree_cookies(gchar *key, gchar *val, GString *gstr)
 {
-    gchar *sep;
+    if (gstr->len > 0)
+        g_string_append(gstr, "; ");
 
-    if (val == NULL)
-        val = "";
+    steam_http_uri_escape_append(gstr, key);
+    g_string_append_c(gstr, '=');
 
-    key = steam_http_uri_escape(key);
-    val = steam_http_uri_escape(val);
+    if (val != NULL)
+        steam_http_uri_escape_append(gstr, val);
 
-    sep = (gstr->len > 0) ? "; " : "";
-    g_string_append_printf(gstr, "%s%s=%s", sep, key, val);
-
-    g_free(key);
-    g_free(val);
     return FALSE;
 }
 
-gchar *steam_http_cookies_str(SteamHttp *http)
+static const GString *steam_http_cookies_hdr(SteamHttp *http)
 {
-    GString *gstr;
+    GString *gstr = http->cookiehdr;
 
-    g_return_val_if_fail(http != NULL, NULL);
+    if (http->cookiehdrgen == http->cookiegen)
+        return gstr;
+
+    g_string_truncate(gstr, 0);
+    http->cookiehdrgen = http->cookiegen;
+
+    if (g_tree_nnodes(http->cookies) < 1)
+        return gstr;
 
-    gstr = g_string_sized_new(128);
     g_tree_foreach(http->cookies, (GTraverseFunc) steam_http_tree_cookies,
                    gstr);
-    return g_string_free(gstr, FALSE);
+    g_string_prepend(gstr, "Cookie: ");
+    g_string_append(gstr, "\r\n");
+    return gstr;
+}
+
+gchar *steam_http_cookies_str(SteamHttp *http)
+{
+    const GString *gstr;
+
+    g_return_val_if_fail(http != NULL, NULL);
+
+    gstr = steam_http_cookies_hdr(http);
+
+    if (gstr->len < 10)
+        return g_strdup("");
+
+    /* Strip the "Cookie: " prefix and the trailing CRLF */
+    return g_strndup(gstr->str + 8, gstr->len - 10);
 }
 
 SteamHttpReq *steam_http_req_new(SteamHttp *http, const gchar *host,
@@ -234,44 +1867,134 @@ SteamHttpReq *steam_http_req_new(SteamHttp *http, const gchar *host,
     req = g_new0(SteamHttpReq, 1);
 
     req->http = http;
-    req->host = g_strdup(host);
+    req->host = steam_http_arena_strdup(&req->arena, host);
     req->port = port;
-    req->path = g_strdup(path);
+    req->path = steam_http_arena_strdup(&req->arena, path);
     req->func = func;
     req->data = data;
+    req->prio = STEAM_HTTP_PRIO_NORMAL;
 
-    req->headers = g_tree_new_full((GCompareDataFunc) g_ascii_strcasecmp,
-                                   NULL, g_free, g_free);
-    req->params  = g_tree_new_full((GCompareDataFunc) g_ascii_strcasecmp,
-                                   NULL, g_free, g_free);
+    /* Zero is never handed out, callers may use it as "none" */
+    if (G_UNLIKELY(++http->reqid == 0))
+        http->reqid++;
 
-    steam_http_req_headers_set(req,
-        STEAM_HTTP_PAIR("User-Agent", http->agent),
-        STEAM_HTTP_PAIR("Host",       host),
-        STEAM_HTTP_PAIR("Accept",     "*/*"),
-        STEAM_HTTP_PAIR("Connection", "Close"),
-        NULL
-    );
+    req->id = http->reqid;
+    g_hash_table_insert(http->reqs, GUINT_TO_POINTER(req->id), req);
 
+    req->headers.pairs = req->headers.inl;
+    req->headers.alloc = STEAM_HTTP_PAIRS_INLINE;
+    req->params.pairs  = req->params.inl;
+    req->params.alloc  = STEAM_HTTP_PAIRS_INLINE;
     return req;
 }
 
+static GSList *steam_http_req_unshare(SteamHttpReq *req)
+{
+    SteamHttpReq *ldr;
+    GSList       *follow;
+    GSList       *l;
+
+    if (req->leader != NULL) {
+        ldr = req->leader;
+        ldr->follow = g_slist_remove(ldr->follow, req);
+        req->leader = NULL;
+        return NULL;
+    }
+
+    if (req->skey == NULL)
+        return NULL;
+
+    if (g_hash_table_lookup(req->http->inflight, req->skey) == req)
+        g_hash_table_remove(req->http->inflight, req->skey);
+
+    follow      = req->follow;
+    req->follow = NULL;
+
+    for (l = follow; l != NULL; l = l->next)
+        ((SteamHttpReq *) l->data)->leader = NULL;
+
+    return follow;
+}
+
 void steam_http_req_free(SteamHttpReq *req)
 {
+    SteamHttp     *http;
+    SteamHttpPool *drain;
+    SteamHttpPool *pool;
+    SteamHttpReq  *ldr;
+    GSList        *follow;
+    GSList        *l;
+    gboolean       kick;
+
     g_return_if_fail(req != NULL);
 
     b_event_remove(req->rsid);
-    http_close(req->request);
+    b_event_remove(req->psid);
+    b_event_remove(req->tosid);
+    steam_http_link_remove(req->http->reqq, &req->rlink);
+    g_hash_table_remove(req->http->reqs, GUINT_TO_POINTER(req->id));
+    follow = steam_http_req_unshare(req);
+    ldr    = NULL;
+
+    /* Hand the shared request over to the oldest follower */
+    if (follow != NULL) {
+        ldr    = follow->data;
+        follow = g_slist_delete_link(follow, follow);
+
+        for (l = follow; l != NULL; l = l->next)
+            ((SteamHttpReq *) l->data)->leader = ldr;
+
+        ldr->follow = follow;
+        g_hash_table_insert(req->http->inflight, ldr->skey, ldr);
+    }
+
+    http  = req->http;
+    drain = NULL;
+    kick  = (req->flags & STEAM_HTTP_REQ_FLAG_QUEUED) &&
+            steam_http_lane_remove(http, req);
+
+    /* A partially transferred reply spoils the connection */
+    if (req->conn != NULL) {
+        drain = req->conn->pool;
+        req->conn->req = NULL;
+        steam_http_conn_free(req->conn);
+    } else if (req->wlink.data != NULL) {
+        pool = steam_http_pool_get(req->http, req, FALSE);
+        steam_http_link_remove(pool->waitq[req->prio], &req->wlink);
+    } else if ((req->http->tport != NULL) &&
+               (req->http->tport->cancel != NULL))
+    {
+        req->http->tport->cancel(req, req->http->tpdata);
+    }
 
     if (req->err != NULL)
         g_error_free(req->err);
 
-    g_tree_destroy(req->headers);
-    g_tree_destroy(req->params);
+    if (req->sbuf != NULL)
+        g_string_free(req->sbuf, TRUE);
+
+    steam_http_arena_free(&req->arena);
 
-    g_free(req->path);
-    g_free(req->host);
+    g_free(req->marks);
+    g_free(req->skey);
+    g_free(req->body);
+    g_free(req->header);
+    g_free(req->lane);
     g_free(req);
+
+    if (http->flags & STEAM_HTTP_FLAG_CLEARING)
+        return;
+
+    /* Only now that the connection is released can the leader have it */
+    if (ldr != NULL)
+        steam_http_req_sendasm(ldr);
+
+    if (drain != NULL)
+        steam_http_pool_next(drain);
+
+    /* A dispatched request gave up its lane, let the next one go */
+    if (kick)
+        steam_http_req_queue(http);
 }
 
 void steam_http_req_headers_set(SteamHttpReq *req, SteamHttpPair *pair, ...)
@@ -281,7 +2004,7 @@ void steam_http_req_headers_set(SteamHttpReq *req, SteamHttpPair *pair, ...)
     g_return_if_fail(req != NULL);
 
     va_start(ap, pair);
-    steam_http_tree_ins(req->headers, pair, ap);
+    steam_http_pairs_ins(&req->headers, &req->arena, pair, ap);
     va_end(ap);
 }
 
@@ -292,10 +2015,34 @@ void steam_http_req_params_set(SteamHttpReq *req, SteamHttpPair *pair, ...)
     g_return_if_fail(req != NULL);
 
     va_start(ap, pair);
-    steam_http_tree_ins(req->params, pair, ap);
+    steam_http_pairs_ins(&req->params, &req->arena, pair, ap);
     va_end(ap);
 }
 
+void steam_http_req_lane_set(SteamHttpReq *req, const gchar *lane)
+{
+    g_return_if_fail(req != NULL);
+
+    g_free(req->lane);
+    req->lane = g_strdup(lane);
+}
+
+gboolean steam_http_req_waiting(SteamHttpReq *req)
+{
+    SteamHttpLane *lane;
+    const gchar   *key;
+
+    g_return_val_if_fail(req != NULL, FALSE);
+
+    if (req->llink.data == NULL)
+        return FALSE;
+
+    /* Only the request at the head of its lane has been dispatched */
+    key  = (req->lane != NULL) ? req->lane : "";
+    lane = g_hash_table_lookup(req->http->lanes, key);
+    return (lane != NULL) && (lane->req != req);
+}
+
 void steam_http_req_resend(SteamHttpReq *req)
 {
     g_return_if_fail(req != NULL);
@@ -306,14 +2053,24 @@ void steam_http_req_resend(SteamHttpReq *req)
     }
 
     b_event_remove(req->rsid);
+    b_event_remove(req->psid);
 
     req->flags |= STEAM_HTTP_REQ_FLAG_NOFREE | STEAM_HTTP_REQ_FLAG_RESEND;
+    req->flags &= ~STEAM_HTTP_REQ_FLAG_PACED;
     req->rsid   = 0;
+    req->psid   = 0;
     req->rsc    = 0;
 
     steam_http_req_send(req);
 }
 
+void steam_http_req_retry_set(SteamHttpReq *req, const SteamHttpRetry *retry)
+{
+    g_return_if_fail(req != NULL);
+
+    req->retry = retry;
+}
+
 static gboolean steam_http_req_done_error(gpointer data, gint fd,
                                           b_input_condition cond)
 {
@@ -324,33 +2081,121 @@ static gboolean steam_http_req_done_error(gpointer data, gint fd,
     return FALSE;
 }
 
-static void steam_http_req_done(SteamHttpReq *req)
+static guint steam_http_req_retry_after(SteamHttpReq *req)
 {
-    if (req->err != NULL) {
-        if (req->rsc < STEAM_HTTP_RESEND_MAX) {
-            g_error_free(req->err);
-            req->err = NULL;
-
-            req->request = NULL;
-            req->rsid    = b_timeout_add(STEAM_HTTP_RESEND_TIMEOUT,
-                                         steam_http_req_done_error, req);
-            req->rsc++;
-            return;
-        }
+    gchar   **hdrs;
+    gchar    *str;
+    gchar    *end;
+    guint64   secs;
+    guint     ret;
+    guint     i;
 
-        g_prefix_error(&req->err, "HTTP: ");
+    if (req->header == NULL)
+        return 0;
+
+    hdrs = g_strsplit(req->header, "\r\n", 0);
+    ret  = 0;
+
+    for (i = 0; hdrs[i] != NULL; i++) {
+        if (g_ascii_strncasecmp(hdrs[i], "Retry-After:", 12) != 0)
+            continue;
+
+        /* Only delta-seconds, an HTTP-date falls back to the backoff */
+        str  = g_strstrip(hdrs[i] + 12);
+        secs = g_ascii_strtoull(str, &end, 10);
+
+        /* Clamped before scaling, a huge value must not wrap around */
+        if (g_ascii_isdigit(*str) && (*end == 0))
+            ret = MIN(secs, STEAM_HTTP_RETRY_AFTER / 1000) * 1000;
+
+        break;
     }
 
-    g_queue_remove(req->http->reqq, req);
+    g_strfreev(hdrs);
+    return ret;
+}
+
+static gboolean steam_http_req_retry(SteamHttpReq *req)
+{
+    static const SteamHttpRetry defr = {
+        STEAM_HTTP_RETRY_MAX,
+        STEAM_HTTP_RETRY_BASE,
+        STEAM_HTTP_RETRY_CAP
+    };
+
+    const SteamHttpRetry *retry;
+    SteamHttp            *http = req->http;
+    guint                 after;
+    guint                 wait;
+
+    retry = (req->retry != NULL) ? req->retry : &defr;
+
+    if (req->rsc >= retry->max)
+        return FALSE;
+
+    /* Transport errors carry no status, everything below 500 is final
+     * with the exception of timeouts and rate limiting.
+     */
+    switch (req->err->code) {
+    case 0:
+    case 408:
+    case 429:
+        break;
+
+    default:
+        if (req->err->code < 500)
+            return FALSE;
+    }
+
+    if (http->rbudget < STEAM_HTTP_RETRY_RATIO)
+        return FALSE;
+
+    /* Full jitter keeps accounts which failed together apart */
+    wait  = MIN(retry->cap, retry->base << MIN(req->rsc, 16));
+    wait  = g_random_int_range(0, wait + 1);
+    after = steam_http_req_retry_after(req);
+
+    http->rbudget -= STEAM_HTTP_RETRY_RATIO;
+    g_error_free(req->err);
+    g_free(req->header);
+    g_free(req->body);
+
+    req->err       = NULL;
+    req->header    = NULL;
+    req->body      = NULL;
+    req->body_size = 0;
+
+    req->rsid = b_timeout_add(MAX(wait, after), steam_http_req_done_error,
+                              req);
+    req->rsc++;
+    return TRUE;
+}
+
+SteamHttpReq *steam_http_req_lookup(SteamHttp *http, guint id)
+{
+    g_return_val_if_fail(http != NULL, NULL);
+
+    return g_hash_table_lookup(http->reqs, GUINT_TO_POINTER(id));
+}
+
+static void steam_http_req_finish(SteamHttpReq *req)
+{
+    steam_http_link_remove(req->http->reqq, &req->rlink);
     req->flags &= ~(STEAM_HTTP_REQ_FLAG_NOFREE | STEAM_HTTP_REQ_FLAG_RESEND);
 
+    if (req->flags & STEAM_HTTP_REQ_FLAG_QUEUED)
+        steam_http_lane_remove(req->http, req);
+
     if (req->func != NULL)
         req->func(req, req->data);
 
     if (req->flags & STEAM_HTTP_REQ_FLAG_QUEUED)
-        steam_http_req_queue(req->http, TRUE);
+        steam_http_req_queue(req->http);
 
-    req->request   = NULL;
+    g_free(req->header);
+    g_free(req->body);
+
+    req->header    = NULL;
     req->body      = NULL;
     req->body_size = 0;
 
@@ -362,53 +2207,110 @@ static void steam_http_req_done(SteamHttpReq *req)
     req->flags &= ~(STEAM_HTTP_REQ_FLAG_NOFREE | STEAM_HTTP_REQ_FLAG_RESEND);
 }
 
-static void steam_http_req_cb(struct http_request *request)
+static void steam_http_req_adapt(SteamHttpReq *req)
 {
-    SteamHttpReq *req = request->data;
+    SteamHttpBucket *bkt;
+    SteamHttpPool   *pool;
+    gboolean         limited;
+
+    /* Transport failures say nothing about the server's limits */
+    if ((req->err != NULL) && (req->err->code == 0))
+        return;
 
-    /* Shortcut some req->request values into req */
-    req->body      = request->reply_body;
-    req->body_size = request->body_size;
+    limited = (req->err != NULL) &&
+              ((req->err->code == 429) || (req->err->code == 503));
 
-#ifdef DEBUG
-    gchar **ls;
-    guint   i;
+    pool = steam_http_pool_get(req->http, req, FALSE);
+    bkt  = g_hash_table_lookup(req->http->paces, GINT_TO_POINTER(req->stat));
+
+    if (pool != NULL)
+        steam_http_bucket_adapt(&pool->bucket, limited);
+
+    if (bkt != NULL)
+        steam_http_bucket_adapt(bkt, limited);
+}
 
-    if (global.conf->verbose) {
-        g_print("HTTP Response (%s:%d%s): %s\n",
-                req->host, req->port, req->path,
-                request->status_string);
+static void steam_http_req_done(SteamHttpReq *req)
+{
+    SteamHttp    *http = req->http;
+    SteamHttpReq *frq;
+    GSList       *follow;
+    GSList       *l;
 
-        if (req->rsc > 0)
-            g_print("Reattempted request: #%u\n", req->rsc);
+    b_event_remove(req->tosid);
+    req->tosid = 0;
+    steam_http_req_adapt(req);
 
-        if (request->reply_headers != NULL) {
-            ls = g_strsplit(request->reply_headers, "\n", 0);
+    if (req->err != NULL) {
+        if (steam_http_req_retry(req))
+            return;
 
-            for (i = 0; ls[i] != NULL; i++)
-                g_print("  %s\n", ls[i]);
+        g_prefix_error(&req->err, "HTTP: ");
+        steam_http_trace_add(req, STEAM_HTTP_TRACE_TYPE_ERROR, req->err->code,
+                             req->err->message, strlen(req->err->message),
+                             NULL, 0);
+
+        if ((http->trace != NULL) && (http->tfunc != NULL))
+            steam_http_trace_dump(http, req->id, http->tfunc, http->tdata);
+    } else if (http->rbudget <
+               (STEAM_HTTP_RETRY_BUDGET * STEAM_HTTP_RETRY_RATIO)) {
+        /* Every success earns back a fraction of a retry */
+        http->rbudget++;
+    }
 
-            g_strfreev(ls);
-        } else {
-            g_print("  ** No header data returned **\n\n");
-        }
+    steam_http_stats_add(http, req);
+    follow = steam_http_req_unshare(req);
 
-        if (req->body_size > 0) {
-            ls = g_strsplit(req->body, "\n", 0);
+    /* Followers get their own copy as the leader discards its reply */
+    for (l = follow; l != NULL; l = l->next) {
+        frq = l->data;
 
-            for (i = 0; ls[i] != NULL; i++)
-                g_print("  %s\n", ls[i]);
+        frq->status    = req->status;
+        frq->header    = g_strdup(req->header);
+        frq->body_size = req->body_size;
 
-            g_strfreev(ls);
-        } else {
-            g_print("  ** No body data returned **\n");
+        if (req->body != NULL) {
+            frq->body = g_malloc(req->body_size + 1);
+            memcpy(frq->body, req->body, req->body_size + 1);
         }
 
-        g_print("\n\n");
+        if (req->err != NULL)
+            frq->err = g_error_copy(req->err);
+
+        l->data = GUINT_TO_POINTER(frq->id);
+    }
+
+    steam_http_req_finish(req);
+
+    for (l = follow; l != NULL; l = l->next) {
+        /* Skip followers freed by an earlier callback */
+        frq = g_hash_table_lookup(http->reqs, l->data);
+
+        if (frq != NULL)
+            steam_http_req_finish(frq);
     }
-#endif /* DEBUG */
 
-    switch (request->status_code) {
+    g_slist_free(follow);
+}
+
+static void steam_http_req_cb(SteamHttpReq *req)
+{
+    gchar *str;
+    gchar *end;
+
+    steam_http_req_mark(req, STEAM_HTTP_MARK_DONE);
+
+    if ((req->http->tport != NULL) && (req->http->tport->reply != NULL))
+        req->http->tport->reply(req, req->http->tpdata);
+
+    /* The reason phrase follows the status code */
+    str = (strlen(req->header) > 13) ? req->header + 13 : "";
+    end = strstr(str, "\r\n");
+    str = g_strndup(str, (end != NULL) ? (gsize) (end - str) : strlen(str));
+
+    steam_http_trace_reply(req);
+
+    switch (req->status) {
     case 200:
     case 301:
     case 302:
@@ -417,170 +2319,323 @@ static void steam_http_req_cb(struct http_request *request)
         break;
 
     default:
-        g_set_error(&req->err, STEAM_HTTP_ERROR, request->status_code,
-                    "%s", request->status_string);
+        g_set_error(&req->err, STEAM_HTTP_ERROR, req->status, "%s", str);
     }
 
+    g_free(str);
     steam_http_req_done(req);
 }
 
-static gboolean steam_http_tree_headers(gchar *key, gchar *val, GString *gstr)
+void steam_http_req_reply(SteamHttpReq *req, gint status, const gchar *header,
+                          const gchar *body, gsize size)
 {
-    if (val == NULL)
-        val = "";
+    g_return_if_fail(req != NULL);
 
-    g_string_append_printf(gstr, "%s: %s\r\n", key, val);
-    return FALSE;
+    req->status    = status;
+    req->header    = g_strdup((header != NULL) ? header : "");
+    req->body      = g_malloc(size + 1);
+    req->body_size = size;
+
+    memcpy(req->body, body, size);
+    req->body[size] = 0;
+    steam_http_req_cb(req);
+}
+
+void steam_http_req_fail(SteamHttpReq *req, const gchar *msg)
+{
+    g_return_if_fail(req != NULL);
+
+    g_set_error(&req->err, STEAM_HTTP_ERROR, 0, "%s", msg);
+    steam_http_req_done(req);
+}
+
+static void steam_http_req_headers_asm(SteamHttpReq *req)
+{
+    SteamHttpPair *p;
+    GString       *gstr = req->sbuf;
+    guint          i;
+
+    for (i = 0; i < req->headers.size; i++) {
+        p = &req->headers.pairs[i];
+
+        g_string_append(gstr, p->key);
+        g_string_append(gstr, ": ");
+
+        if (p->val != NULL)
+            g_string_append(gstr, p->val);
+
+        g_string_append(gstr, "\r\n");
+    }
+}
+
+static void steam_http_req_params_asm(SteamHttpReq *req, GString *gstr)
+{
+    SteamHttpPair *p;
+    guint          i;
+
+    for (i = 0; i < req->params.size; i++) {
+        p = &req->params.pairs[i];
+
+        if (i > 0)
+            g_string_append_c(gstr, '&');
+
+        steam_http_uri_escape_append(gstr, p->key);
+        g_string_append_c(gstr, '=');
+
+        if (p->val != NULL)
+            steam_http_uri_escape_append(gstr, p->val);
+    }
 }
 
-static gboolean steam_http_tree_params(gchar *key, gchar *val, GString *gstr)
+static guint steam_http_req_pace(SteamHttpReq *req, SteamHttpPool *pool)
 {
-    gchar *sep;
+    SteamHttpBucket *bkt;
+    guint            wait;
+
+    wait = steam_http_bucket_take(&pool->bucket);
+
+    /* Interactive requests spend host tokens, but never wait for them */
+    if (req->prio <= STEAM_HTTP_PRIO_POLL)
+        wait = 0;
+
+    bkt = g_hash_table_lookup(req->http->paces, GINT_TO_POINTER(req->stat));
+
+    if (bkt != NULL)
+        wait = MAX(wait, steam_http_bucket_take(bkt));
 
-    if (val == NULL)
-        val = "";
+    return wait;
+}
+
+static gboolean steam_http_req_pace_cb(gpointer data, gint fd,
+                                       b_input_condition cond)
+{
+    SteamHttpReq *req = data;
 
-    key = steam_http_uri_escape(key);
-    val = steam_http_uri_escape(val);
+    req->psid = 0;
+    steam_http_req_sendasm(req);
+    return FALSE;
+}
 
-    sep = (gstr->len > 0) ? "&" : "";
-    g_string_append_printf(gstr, "%s%s=%s", sep, key, val);
+static gboolean steam_http_req_timeout_cb(gpointer data, gint fd,
+                                          b_input_condition cond)
+{
+    SteamHttpReq  *req  = data;
+    SteamHttpConn *conn = req->conn;
+    SteamHttpPool *pool;
+
+    req->tosid = 0;
+
+    /* Nothing more can be expected of the connection, drop it */
+    if (conn != NULL) {
+        pool      = conn->pool;
+        conn->req = NULL;
+        req->conn = NULL;
+
+        steam_http_conn_free(conn);
+        steam_http_pool_next(pool);
+    } else if ((req->http->tport != NULL) &&
+               (req->http->tport->cancel != NULL))
+    {
+        req->http->tport->cancel(req, req->http->tpdata);
+    }
 
-    g_free(key);
-    g_free(val);
+    steam_http_req_fail(req, "Request timed out");
     return FALSE;
 }
 
 static void steam_http_req_sendasm(SteamHttpReq *req)
 {
-    GString *gstr;
-    gchar   *hs;
-    gchar   *ps;
-    gchar   *len;
-    gchar   *str;
+    const SteamHttpTransport *tport;
+    SteamHttpPool            *pool;
+    SteamHttpConn            *conn;
+    const GString            *cstr;
+    GString                  *gstr;
+    gchar                     len[24];
+    gsize                     size;
+    gsize                     pos;
+    guint                     wait;
+
+    tport = req->http->tport;
+    pool  = steam_http_pool_get(req->http, req, TRUE);
+    conn  = NULL;
+
+    /* Tokens are taken once, a request waiting on the pool keeps them */
+    if (!(req->flags & STEAM_HTTP_REQ_FLAG_PACED)) {
+        req->flags |= STEAM_HTTP_REQ_FLAG_PACED;
+        wait = steam_http_req_pace(req, pool);
+
+        if (wait > 0) {
+            req->psid = b_timeout_add(wait, steam_http_req_pace_cb, req);
+            return;
+        }
+    }
 
-    gstr = g_string_sized_new(128);
-    g_tree_foreach(req->params, (GTraverseFunc) steam_http_tree_params, gstr);
-    len = g_strdup_printf("%" G_GSIZE_FORMAT, gstr->len);
-    ps  = g_string_free(gstr, FALSE);
+    if ((tport == NULL) || (tport->send == NULL)) {
+        conn = steam_http_pool_conn(pool, req->prio);
 
-    if (g_tree_nnodes(req->http->cookies) > 0) {
-        str = steam_http_cookies_str(req->http);
-        steam_http_req_headers_set(req, STEAM_HTTP_PAIR("Cookie", str), NULL);
-        g_free(str);
+        if (conn == NULL) {
+            steam_http_link_push(pool->waitq[req->prio], &req->wlink, req,
+                                 FALSE);
+            return;
+        }
     }
 
-    if (req->flags & STEAM_HTTP_REQ_FLAG_POST) {
-        steam_http_req_headers_set(req,
-            STEAM_HTTP_PAIR("Content-Type",   "application/"
-                                              "x-www-form-urlencoded"),
-            STEAM_HTTP_PAIR("Content-Length", len),
-            NULL
-        );
+    req->flags &= ~STEAM_HTTP_REQ_FLAG_PACED;
+
+    if (req->marks != NULL) {
+        memset(req->marks + STEAM_HTTP_MARK_DISPATCH, 0, sizeof *req->marks *
+               (STEAM_HTTP_MARK_LAST - STEAM_HTTP_MARK_DISPATCH));
+        steam_http_req_mark(req, STEAM_HTTP_MARK_DISPATCH);
+
+        if ((conn == NULL) ||
+            (conn->flags & STEAM_HTTP_CONN_FLAG_CONNECTED))
+        {
+            req->marks[STEAM_HTTP_MARK_CONNECT] =
+                req->marks[STEAM_HTTP_MARK_DISPATCH];
+            req->marks[STEAM_HTTP_MARK_TLS] =
+                req->marks[STEAM_HTTP_MARK_DISPATCH];
+        }
+    }
+
+    if (req->sbuf == NULL) {
+        size = GPOINTER_TO_SIZE(g_hash_table_lookup(pool->sizes, req->path));
+        req->sbuf = g_string_sized_new(MAX(size, STEAM_HTTP_POOL_SIZE));
     }
 
-    gstr = g_string_sized_new(128);
-    g_tree_foreach(req->headers, (GTraverseFunc) steam_http_tree_headers, gstr);
-    hs = g_string_free(gstr, FALSE);
+    gstr = req->sbuf;
+    g_string_truncate(gstr, 0);
 
     if (req->flags & STEAM_HTTP_REQ_FLAG_POST) {
-        str = g_strdup_printf("POST %s HTTP/1.1\r\n%s\r\n%s",
-                              req->path, hs, ps);
+        g_string_append(gstr, "POST ");
+        g_string_append(gstr, req->path);
     } else {
-        str = g_strdup_printf("GET %s?%s HTTP/1.1\r\n%s\r\n",
-                              req->path, ps, hs);
-    }
-
-#ifdef DEBUG
-    gchar **ls;
-    guint   i;
+        g_string_append(gstr, "GET ");
+        g_string_append(gstr, req->path);
 
-    if (global.conf->verbose) {
-        g_print("HTTP Request (%s:%d%s)\n", req->host, req->port, req->path);
+        if (req->params.size > 0) {
+            g_string_append_c(gstr, '?');
+            steam_http_req_params_asm(req, gstr);
+        }
+    }
 
-        if (req->rsc > 0)
-            g_print("Reattempted request: #%u\n", req->rsc);
+    g_string_append(gstr, " HTTP/1.1\r\n");
+    g_string_append_len(gstr, pool->header, pool->header_size);
+    steam_http_req_headers_asm(req);
 
-        if (hs != NULL) {
-            ls = g_strsplit(hs, "\n", 0);
+    cstr = steam_http_cookies_hdr(req->http);
+    g_string_append_len(gstr, cstr->str, cstr->len);
 
-            for (i = 0; ls[i] != NULL; i++)
-                g_print("  %s\n", ls[i]);
+    if (req->flags & STEAM_HTTP_REQ_FLAG_POST) {
+        g_string_append(gstr, "Content-Type: application/"
+                              "x-www-form-urlencoded\r\n"
+                              "Content-Length: ");
 
-            g_strfreev(ls);
-        } else {
-            g_print("  ** No header data **\n\n");
-        }
+        pos = gstr->len;
+        g_string_append(gstr, "\r\n\r\n");
 
-        if (ps != NULL) {
-            ls = g_strsplit(ps, "\n", 0);
+        size = gstr->len;
+        steam_http_req_params_asm(req, gstr);
 
-            for (i = 0; ls[i] != NULL; i++)
-                g_print("  %s\n", ls[i]);
+        /* The length is only known once the params are escaped */
+        g_snprintf(len, sizeof len, "%" G_GSIZE_FORMAT, gstr->len - size);
+        g_string_insert(gstr, pos, len);
+    } else {
+        g_string_append(gstr, "\r\n");
+    }
 
-            g_strfreev(ls);
-        } else {
-            g_print("  ** No body data **\n");
-        }
+    size = GPOINTER_TO_SIZE(g_hash_table_lookup(pool->sizes, req->path));
 
-        g_print("\n\n");
+    if (gstr->len >= size) {
+        g_hash_table_replace(pool->sizes, g_strdup(req->path),
+                             GSIZE_TO_POINTER(gstr->len + 1));
     }
-#endif /* DEBUG */
 
-    req->request = http_dorequest(req->host, req->port,
-                                  (req->flags & STEAM_HTTP_REQ_FLAG_SSL),
-                                  str, steam_http_req_cb, req);
+    steam_http_trace_add(req, STEAM_HTTP_TRACE_TYPE_REQUEST, 0,
+                         gstr->str, gstr->len, NULL, 0);
 
-    g_free(len);
-    g_free(ps);
-    g_free(hs);
-    g_free(str);
+    /* Covers the long poll, which the server holds for a while */
+    b_event_remove(req->tosid);
+    req->tosid = b_timeout_add(STEAM_HTTP_REQ_TIMEOUT,
+                               steam_http_req_timeout_cb, req);
 
-    if (G_UNLIKELY(req->request == NULL)) {
-        g_set_error(&req->err, STEAM_HTTP_ERROR, 0, "Failed to init request");
-        steam_http_req_done(req);
+    if (conn == NULL) {
+        tport->send(req, req->http->tpdata);
         return;
     }
 
-    /* Prevent automatic redirection */
-    req->request->redir_ttl = 0;
+    steam_http_conn_send(conn, req);
+
+    /* The long poll holds its connection, keep another one ready */
+    if (req->prio == STEAM_HTTP_PRIO_POLL)
+        steam_http_pool_warm(pool);
 }
 
-static void steam_http_req_queue(SteamHttp *http, gboolean force)
+static void steam_http_req_queue(SteamHttp *http)
 {
-    SteamHttpReq *req;
-    SteamHttpReq *treq;
-    GList        *l;
+    SteamHttpLane *lane;
 
     if (http->flags & STEAM_HTTP_FLAG_PAUSED)
         return;
 
-    if (!force && (http->flags & STEAM_HTTP_FLAG_QUEUED))
-        return;
+    while (http->lanes_busy < http->lanes_max) {
+        lane = g_queue_peek_head(http->laneq);
 
-    req = NULL;
+        if (lane == NULL)
+            break;
 
-    for (l = http->reqq->tail; l != NULL; l = l->prev) {
-        treq = l->data;
+        steam_http_link_remove(http->laneq, &lane->qlink);
+        lane->req = g_queue_peek_head(lane->reqq);
+        http->lanes_busy++;
+        steam_http_req_sendasm(lane->req);
+    }
+}
 
-        if (!(treq->flags & STEAM_HTTP_REQ_FLAG_QUEUED))
-            continue;
+static gboolean steam_http_req_share(SteamHttpReq *req)
+{
+    SteamHttp     *http = req->http;
+    SteamHttpPool *pool;
+    SteamHttpReq  *ldr;
+    GString       *gstr;
 
-        req = l->data;
-        break;
+    if (req->leader != NULL)
+        return FALSE;
+
+    if (req->skey != NULL) {
+        if (g_hash_table_lookup(http->inflight, req->skey) == req)
+            return FALSE;
+
+        g_free(req->skey);
     }
 
-    if (req == NULL) {
-        http->flags &= ~STEAM_HTTP_FLAG_QUEUED;
-        return;
-    } else {
-        http->flags |= STEAM_HTTP_FLAG_QUEUED;
+    gstr = g_string_sized_new(256);
+    g_string_append_printf(gstr, "%s:%d%s?", req->host, req->port, req->path);
+    steam_http_req_params_asm(req, gstr);
+    req->skey = g_string_free(gstr, FALSE);
+
+    ldr = g_hash_table_lookup(http->inflight, req->skey);
+
+    if (ldr == NULL) {
+        g_hash_table_insert(http->inflight, req->skey, req);
+        return FALSE;
     }
 
-    steam_http_req_sendasm(req);
+    req->leader = ldr;
+    ldr->follow = g_slist_append(ldr->follow, req);
+    steam_http_link_push(http->reqq, &req->rlink, req, TRUE);
+
+    /* A waiting leader inherits the most urgent follower's class */
+    if (req->prio < ldr->prio) {
+        pool = steam_http_pool_get(http, ldr, FALSE);
+
+        if (steam_http_link_remove(pool->waitq[ldr->prio], &ldr->wlink)) {
+            steam_http_link_push(pool->waitq[req->prio], &ldr->wlink, ldr,
+                                 FALSE);
+        }
 
-    if (G_UNLIKELY(req->request == NULL))
-        g_queue_remove(req->http->reqq, req);
+        ldr->prio = req->prio;
+    }
+
+    return TRUE;
 }
 
 void steam_http_req_send(SteamHttpReq *req)
@@ -592,56 +2647,198 @@ void steam_http_req_send(SteamHttpReq *req)
         return;
     }
 
-    if (req->flags & STEAM_HTTP_REQ_FLAG_RESEND) {
-        g_queue_push_tail(req->http->reqq, req);
+    if ((req->http->stats != NULL) && (req->marks == NULL))
+        req->marks = g_new0(gint64, STEAM_HTTP_MARK_LAST);
 
-        if (req->flags & STEAM_HTTP_REQ_FLAG_QUEUED)
-            steam_http_req_queue(req->http, FALSE);
-        else
-            steam_http_req_sendasm(req);
+    steam_http_req_mark(req, STEAM_HTTP_MARK_ENQUEUE);
+
+    /* Identical reads already in flight are answered together */
+    if ((req->flags & STEAM_HTTP_REQ_FLAG_SHARED) &&
+        !(req->flags & (STEAM_HTTP_REQ_FLAG_POST |
+                        STEAM_HTTP_REQ_FLAG_QUEUED)) &&
+        steam_http_req_share(req))
+    {
         return;
     }
 
     if (req->flags & STEAM_HTTP_REQ_FLAG_QUEUED) {
-        g_queue_push_head(req->http->reqq, req);
-        steam_http_req_queue(req->http, FALSE);
+        steam_http_link_push(req->http->reqq, &req->rlink, req, TRUE);
+        steam_http_lane_push(req->http, req);
+        steam_http_req_queue(req->http);
+        return;
+    }
+
+    if (req->flags & STEAM_HTTP_REQ_FLAG_RESEND) {
+        steam_http_link_push(req->http->reqq, &req->rlink, req, FALSE);
+        steam_http_req_sendasm(req);
         return;
     }
 
+    steam_http_link_push(req->http->reqq, &req->rlink, req, TRUE);
     steam_http_req_sendasm(req);
+}
+
+static const guint8 steam_http_uri_unres[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static const gint8 steam_http_uri_hex[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+#ifdef __SSE2__
+static inline __m128i steam_http_uri_range(__m128i v, gchar lo, gchar hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+#endif /* __SSE2__ */
+
+static gsize steam_http_uri_span(const guchar *str, gsize size)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    __m128i v;
+    __m128i m;
+    guint   mask;
+
+    /* Bytes above 0x7F compare as negative and never match a range */
+    for (; (i + 16) <= size; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (str + i));
+        m = _mm_or_si128(steam_http_uri_range(v, '0', '9'),
+                         steam_http_uri_range(v, 'A', 'Z'));
+        m = _mm_or_si128(m, steam_http_uri_range(v, 'a', 'z'));
+        m = _mm_or_si128(m, steam_http_uri_range(v, '-', '.'));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
+
+        mask = _mm_movemask_epi8(m);
+
+        if (mask != 0xFFFF)
+            return i + g_bit_nth_lsf(~mask, -1);
+    }
+#endif /* __SSE2__ */
 
-    if (G_LIKELY(req->request != NULL))
-        g_queue_push_head(req->http->reqq, req);
+    while ((i < size) && steam_http_uri_unres[str[i]])
+        i++;
+
+    return i;
 }
 
 gchar *steam_http_uri_escape(const gchar *unescaped)
 {
-    gchar *ret;
-    gchar *str;
+    GString *gstr;
 
     g_return_val_if_fail(unescaped != NULL, NULL);
 
-    str = g_strndup(unescaped, (strlen(unescaped) * 3) + 1);
-    http_encode(str);
+    gstr = g_string_sized_new(strlen(unescaped) + 16);
+    steam_http_uri_escape_append(gstr, unescaped);
+    return g_string_free(gstr, FALSE);
+}
+
+void steam_http_uri_escape_append(GString *gstr, const gchar *unescaped)
+{
+    static const gchar hex[] = "0123456789ABCDEF";
 
-    ret = g_strdup(str);
-    g_free(str);
+    const guchar *str = (const guchar *) unescaped;
+    gchar         enc[3];
+    gsize         size;
+    gsize         n;
 
-    return ret;
+    g_return_if_fail(gstr      != NULL);
+    g_return_if_fail(unescaped != NULL);
+
+    size   = strlen(unescaped);
+    enc[0] = '%';
+
+    while (size > 0) {
+        n = steam_http_uri_span(str, size);
+
+        if (n > 0) {
+            g_string_append_len(gstr, (const gchar *) str, n);
+            str  += n;
+            size -= n;
+
+            if (size < 1)
+                break;
+        }
+
+        enc[1] = hex[*str >> 4];
+        enc[2] = hex[*str & 0x0F];
+        g_string_append_len(gstr, enc, 3);
+
+        str++;
+        size--;
+    }
 }
 
 gchar *steam_http_uri_unescape(const gchar *escaped)
 {
-    gchar *ret;
-    gchar *str;
+    GString *gstr;
 
     g_return_val_if_fail(escaped != NULL, NULL);
 
-    str = g_strdup(escaped);
-    http_decode(str);
+    gstr = g_string_sized_new(strlen(escaped));
+    steam_http_uri_unescape_append(gstr, escaped);
+    return g_string_free(gstr, FALSE);
+}
+
+void steam_http_uri_unescape_append(GString *gstr, const gchar *escaped)
+{
+    const guchar *str = (const guchar *) escaped;
+    const guchar *pct;
+    gint8         hi;
+    gint8         lo;
+
+    g_return_if_fail(gstr    != NULL);
+    g_return_if_fail(escaped != NULL);
+
+    while ((pct = (const guchar *) strchr((const gchar *) str, '%')) != NULL) {
+        g_string_append_len(gstr, (const gchar *) str, pct - str);
+
+        /* A truncated or bogus sequence is passed through untouched */
+        if (((hi = steam_http_uri_hex[pct[1]]) < 0) ||
+            ((lo = steam_http_uri_hex[pct[2]]) < 0))
+        {
+            g_string_append_c(gstr, '%');
+            str = pct + 1;
+            continue;
+        }
 
-    ret = g_strdup(str);
-    g_free(str);
+        g_string_append_c(gstr, (hi << 4) | lo);
+        str = pct + 3;
+    }
 
-    return ret;
+    g_string_append(gstr, (const gchar *) str);
 }
@@ -19,25 +19,107 @@
 #define _STEAM_HTTP_H
 
 #include <glib.h>
-#include <http_client.h>
 
-#define STEAM_HTTP_RESEND_MAX     3
-#define STEAM_HTTP_RESEND_TIMEOUT 2000
+#define STEAM_HTTP_ARENA_SIZE     1024
+#define STEAM_HTTP_DNS_REFRESH    240000
+#define STEAM_HTTP_DNS_TTL        300000
+#define STEAM_HTTP_HIST_SIZE      512
+#define STEAM_HTTP_INFLATE_MAX    (8 * 1024 * 1024)
+#define STEAM_HTTP_INFLATE_SIZE   8192
+#define STEAM_HTTP_LANES_MAX      4
+#define STEAM_HTTP_PACE_BURST     20
+#define STEAM_HTTP_PACE_FLOOR     16
+#define STEAM_HTTP_PACE_RATE      10
+#define STEAM_HTTP_PACE_STEP      32
+#define STEAM_HTTP_PAIRS_INLINE   8
+#define STEAM_HTTP_POOL_MAX       6
+#define STEAM_HTTP_POOL_SIZE      512
+#define STEAM_HTTP_POOL_TIMEOUT   30000
+#define STEAM_HTTP_REQ_TIMEOUT    60000
+#define STEAM_HTTP_RETRY_AFTER    300000
+#define STEAM_HTTP_RETRY_BASE     1000
+#define STEAM_HTTP_RETRY_BUDGET   20
+#define STEAM_HTTP_RETRY_CAP      30000
+#define STEAM_HTTP_RETRY_MAX      3
+#define STEAM_HTTP_RETRY_RATIO    10
+#define STEAM_HTTP_TRACE_DATA     480
+#define STEAM_HTTP_TRACE_SIZE     64
 
 #define STEAM_HTTP_PAIR(k, v) ((SteamHttpPair *) &((SteamHttpPair) {k, v}))
 
-typedef enum   _SteamHttpFlags    SteamHttpFlags;
-typedef enum   _SteamHttpReqFlags SteamHttpReqFlags;
-typedef struct _SteamHttp         SteamHttp;
-typedef struct _SteamHttpPair     SteamHttpPair;
-typedef struct _SteamHttpReq      SteamHttpReq;
+typedef enum   _SteamHttpConnFlags SteamHttpConnFlags;
+typedef enum   _SteamHttpFlags     SteamHttpFlags;
+typedef enum   _SteamHttpMark      SteamHttpMark;
+typedef enum   _SteamHttpPrio      SteamHttpPrio;
+typedef enum   _SteamHttpReqFlags  SteamHttpReqFlags;
+typedef enum   _SteamHttpTraceType SteamHttpTraceType;
+typedef struct _SteamHttp          SteamHttp;
+typedef struct _SteamHttpArena     SteamHttpArena;
+typedef struct _SteamHttpBucket    SteamHttpBucket;
+typedef struct _SteamHttpConn      SteamHttpConn;
+typedef struct _SteamHttpDns       SteamHttpDns;
+typedef struct _SteamHttpDnsJob    SteamHttpDnsJob;
+typedef struct _SteamHttpHist      SteamHttpHist;
+typedef struct _SteamHttpLane      SteamHttpLane;
+typedef struct _SteamHttpPair      SteamHttpPair;
+typedef struct _SteamHttpPairs     SteamHttpPairs;
+typedef struct _SteamHttpPool      SteamHttpPool;
+typedef struct _SteamHttpReq       SteamHttpReq;
+typedef struct _SteamHttpRetry     SteamHttpRetry;
+typedef struct _SteamHttpStats     SteamHttpStats;
+typedef struct _SteamHttpTrace     SteamHttpTrace;
+typedef struct _SteamHttpTraceRec  SteamHttpTraceRec;
+typedef struct _SteamHttpTransport SteamHttpTransport;
 
 typedef void (*SteamHttpFunc) (SteamHttpReq *req, gpointer data);
+typedef void (*SteamHttpTraceFunc) (const gchar *line, gpointer data);
+
+enum _SteamHttpConnFlags
+{
+    STEAM_HTTP_CONN_FLAG_CONNECTED = 1 << 0,
+    STEAM_HTTP_CONN_FLAG_RECEIVED  = 1 << 1,
+    STEAM_HTTP_CONN_FLAG_HEADERS   = 1 << 2,
+    STEAM_HTTP_CONN_FLAG_CHUNKED   = 1 << 3,
+    STEAM_HTTP_CONN_FLAG_TRAILER   = 1 << 4,
+    STEAM_HTTP_CONN_FLAG_EOF       = 1 << 5,
+    STEAM_HTTP_CONN_FLAG_CLOSE     = 1 << 6,
+    STEAM_HTTP_CONN_FLAG_GZIP      = 1 << 7,
+    STEAM_HTTP_CONN_FLAG_DEFLATE   = 1 << 8
+};
 
 enum _SteamHttpFlags
 {
-    STEAM_HTTP_FLAG_PAUSED = 1 << 0,
-    STEAM_HTTP_FLAG_QUEUED = 1 << 1
+    STEAM_HTTP_FLAG_PAUSED   = 1 << 0,
+    STEAM_HTTP_FLAG_CLEARING = 1 << 1
+};
+
+enum _SteamHttpMark
+{
+    STEAM_HTTP_MARK_ENQUEUE = 0,
+    STEAM_HTTP_MARK_DISPATCH,
+    STEAM_HTTP_MARK_CONNECT,
+    STEAM_HTTP_MARK_TLS,
+    STEAM_HTTP_MARK_FIRST,
+    STEAM_HTTP_MARK_DONE,
+
+    STEAM_HTTP_MARK_LAST
+};
+
+enum _SteamHttpPrio
+{
+    STEAM_HTTP_PRIO_SEND = 0,
+    STEAM_HTTP_PRIO_POLL,
+    STEAM_HTTP_PRIO_NORMAL,
+    STEAM_HTTP_PRIO_BACKFILL,
+
+    STEAM_HTTP_PRIO_LAST
+};
+
+enum _SteamHttpTraceType
+{
+    STEAM_HTTP_TRACE_TYPE_REQUEST = 0,
+    STEAM_HTTP_TRACE_TYPE_REPLY,
+    STEAM_HTTP_TRACE_TYPE_ERROR
 };
 
 enum _SteamHttpReqFlags
@@ -48,16 +130,116 @@ enum _SteamHttpReqFlags
 
     STEAM_HTTP_REQ_FLAG_NOFREE = 1 << 3,
     STEAM_HTTP_REQ_FLAG_QUEUED = 1 << 4,
-    STEAM_HTTP_REQ_FLAG_RESEND = 1 << 5
+    STEAM_HTTP_REQ_FLAG_RESEND = 1 << 5,
+    STEAM_HTTP_REQ_FLAG_SHARED = 1 << 6,
+    STEAM_HTTP_REQ_FLAG_PACED  = 1 << 7,
+    STEAM_HTTP_REQ_FLAG_IDEMP  = 1 << 8
 };
 
 struct _SteamHttp
 {
     SteamHttpFlags flags;
 
-    gchar  *agent;
-    GQueue *reqq;
-    GTree  *cookies;
+    gchar      *agent;
+    GQueue     *reqq;
+    GHashTable *reqs;
+    guint       reqid;
+    GTree      *cookies;
+    GString    *cookiehdr;
+    guint       cookiegen;
+    guint       cookiehdrgen;
+    GHashTable *pools;
+    GHashTable *inflight;
+    GHashTable *stats;
+
+    SteamHttpTrace     *trace;
+    SteamHttpTraceFunc  tfunc;
+    gpointer            tdata;
+
+    const SteamHttpTransport *tport;
+    gpointer                  tpdata;
+
+    GHashTable *lanes;
+    GQueue     *laneq;
+    guint       lanes_max;
+    guint       lanes_busy;
+
+    GHashTable *paces;
+    gdouble     prate;
+    guint       pburst;
+
+    guint    rbudget;
+    gpointer zstrm;
+};
+
+struct _SteamHttpArena
+{
+    gpointer  blocks;
+    gchar    *pos;
+    gsize     rem;
+};
+
+struct _SteamHttpBucket
+{
+    gdouble rate;
+    gdouble burst;
+    gdouble tokens;
+    gdouble scale;
+    gint64  stamp;
+};
+
+struct _SteamHttpConn
+{
+    SteamHttpPool      *pool;
+    SteamHttpReq       *req;
+    SteamHttpConnFlags  flags;
+    SteamHttpDns       *dns;
+
+    gpointer ssl;
+    gint     fd;
+    gint     ioid;
+    gint     toid;
+
+    const gchar *wbuf;
+    gsize        wsize;
+    gsize        wpos;
+
+    GString *rbuf;
+    GString *body;
+    gchar   *header;
+    gint     status;
+    gint64   csize;
+    guint    reqs;
+};
+
+struct _SteamHttpDns
+{
+    gchar    *host;
+    gchar    *addr;
+    gint64    stamp;
+    gboolean  busy;
+    GSList   *conns;
+};
+
+struct _SteamHttpDnsJob
+{
+    gchar *host;
+    gchar *addr;
+    gint   fd;
+};
+
+struct _SteamHttpHist
+{
+    guint64 count;
+    guint32 buckets[STEAM_HTTP_HIST_SIZE];
+};
+
+struct _SteamHttpLane
+{
+    gchar        *key;
+    GQueue       *reqq;
+    SteamHttpReq *req;
+    GList         qlink;
 };
 
 struct _SteamHttpPair
@@ -66,29 +248,123 @@ struct _SteamHttpPair
     const gchar *val;
 };
 
+struct _SteamHttpPairs
+{
+    SteamHttpPair *pairs;
+    guint          size;
+    guint          alloc;
+
+    SteamHttpPair inl[STEAM_HTTP_PAIRS_INLINE];
+};
+
+struct _SteamHttpPool
+{
+    SteamHttp *http;
+
+    gchar    *host;
+    gint      port;
+    gboolean  ssl;
+
+    gchar      *header;
+    gsize       header_size;
+    GHashTable *sizes;
+
+    GQueue          *idle;
+    GQueue          *waitq[STEAM_HTTP_PRIO_LAST];
+    SteamHttpConn   *warm;
+    guint            size;
+    SteamHttpBucket  bucket;
+};
+
+struct _SteamHttpRetry
+{
+    guint max;
+    guint base;
+    guint cap;
+};
+
+struct _SteamHttpStats
+{
+    /* The total, followed by the span leading up to each mark */
+    SteamHttpHist hists[STEAM_HTTP_MARK_LAST];
+};
+
+struct _SteamHttpTraceRec
+{
+    gint64             time;
+    guint              id;
+    SteamHttpTraceType type;
+    gint               status;
+    guint32            total;
+    guint16            hsize;
+    guint16            size;
+
+    gchar data[STEAM_HTTP_TRACE_DATA];
+};
+
+struct _SteamHttpTrace
+{
+    SteamHttpTraceRec recs[STEAM_HTTP_TRACE_SIZE];
+    guint             next;
+    guint             count;
+};
+
+struct _SteamHttpTransport
+{
+    /* Takes over sending from the connection pool when set */
+    void (*send)   (SteamHttpReq *req, gpointer data);
+    void (*cancel) (SteamHttpReq *req, gpointer data);
+
+    /* Sees every reply before it is handed to the request */
+    void (*reply)  (SteamHttpReq *req, gpointer data);
+    void (*free)   (gpointer data);
+};
+
 struct _SteamHttpReq
 {
     SteamHttp         *http;
     SteamHttpReqFlags  flags;
+    SteamHttpPrio      prio;
+    guint              id;
+
+    GList rlink;
+    GList wlink;
+    GList llink;
 
     gchar *host;
     gint   port;
     gchar *path;
+    gchar *lane;
 
-    GTree *headers;
-    GTree *params;
+    SteamHttpArena  arena;
+    SteamHttpPairs  headers;
+    SteamHttpPairs  params;
+    GString        *sbuf;
 
     SteamHttpFunc func;
     gpointer      data;
 
-    struct http_request *request;
+    SteamHttpConn *conn;
 
     GError *err;
+    gint    status;
+    gchar  *header;
     gchar  *body;
     gint    body_size;
 
+    const SteamHttpRetry *retry;
+
+    gint    stat;
+    gint64 *marks;
+
+    SteamHttpReq *leader;
+    GSList       *follow;
+    gchar        *skey;
+
     gint   rsid;
     guint8 rsc;
+    gint   psid;
+    gint   tosid;
 };
 
 #define STEAM_HTTP_ERROR steam_http_error_quark()
@@ -101,8 +377,35 @@ void steam_http_free_reqs(SteamHttp *http);
 
 void steam_http_free(SteamHttp *http);
 
+void steam_http_dns_prefetch(const gchar *host);
+
 void steam_http_queue_pause(SteamHttp *http, gboolean puase);
 
+void steam_http_queue_lanes(SteamHttp *http, guint lanes);
+
+void steam_http_pace_host(SteamHttp *http, gdouble rate, guint burst);
+
+void steam_http_pace_set(SteamHttp *http, gint stat, gdouble rate,
+                         guint burst);
+
+void steam_http_stats_enable(SteamHttp *http, gboolean enable);
+
+const SteamHttpStats *steam_http_stats_get(SteamHttp *http, gint stat);
+
+gint64 steam_http_hist_pct(const SteamHttpHist *hist, gdouble pct);
+
+void steam_http_transport_set(SteamHttp *http,
+                              const SteamHttpTransport *tport,
+                              gpointer data);
+
+void steam_http_trace_set(SteamHttp *http, gboolean enable,
+                          SteamHttpTraceFunc func, gpointer data);
+
+void steam_http_trace_redact(gchar *data, gsize size);
+
+void steam_http_trace_dump(SteamHttp *http, guint id, SteamHttpTraceFunc func,
+                           gpointer data);
+
 void steam_http_cookies_set(SteamHttp *http, SteamHttpPair *pair, ...)
     G_GNUC_NULL_TERMINATED;
 
@@ -118,18 +421,35 @@ SteamHttpReq *steam_http_req_new(SteamHttp *http, const gchar *host,
 
 void steam_http_req_free(SteamHttpReq *req);
 
+SteamHttpReq *steam_http_req_lookup(SteamHttp *http, guint id);
+
 void steam_http_req_headers_set(SteamHttpReq *req, SteamHttpPair *pair, ...)
     G_GNUC_NULL_TERMINATED;
 
 void steam_http_req_params_set(SteamHttpReq *req, SteamHttpPair *pair, ...)
     G_GNUC_NULL_TERMINATED;
 
+void steam_http_req_lane_set(SteamHttpReq *req, const gchar *lane);
+
+gboolean steam_http_req_waiting(SteamHttpReq *req);
+
 void steam_http_req_resend(SteamHttpReq *req);
 
+void steam_http_req_retry_set(SteamHttpReq *req, const SteamHttpRetry *retry);
+
 void steam_http_req_send(SteamHttpReq *req);
 
+void steam_http_req_reply(SteamHttpReq *req, gint status, const gchar *header,
+                          const gchar *body, gsize size);
+
+void steam_http_req_fail(SteamHttpReq *req, const gchar *msg);
+
 gchar *steam_http_uri_escape(const gchar *unescaped);
 
+void steam_http_uri_escape_append(GString *gstr, const gchar *unescaped);
+
 gchar *steam_http_uri_unescape(const gchar *escaped);
 
+void steam_http_uri_unescape_append(GString *gstr, const gchar *escaped);
+
 #endif /* _STEAM_HTTP_H */
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "steam-mark.h"
+
+GQuark steam_mark_error_quark(void)
+{
+    static GQuark q;
+
+    if (G_UNLIKELY(q == 0))
+        q = g_quark_from_static_string("steam-mark-error-quark");
+
+    return q;
+}
+
+guint32 steam_mark_hash(const gchar *text)
+{
+    guint32 hash;
+
+    /* FNV-1a, the index must hash the same on every build */
+    for (hash = 2166136261U; (text != NULL) && (*text != 0); text++) {
+        hash ^= (guchar) *text;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+SteamMarks *steam_marks_new(const gchar *path)
+{
+    SteamMarks *marks;
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    marks = g_new0(SteamMarks, 1);
+    marks->path  = g_strdup(path);
+    marks->marks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         g_free);
+
+    return marks;
+}
+
+void steam_marks_free(SteamMarks *marks)
+{
+    g_return_if_fail(marks != NULL);
+
+    if (marks->ev > 0)
+        b_event_remove(marks->ev);
+
+    g_hash_table_destroy(marks->marks);
+    g_free(marks->path);
+    g_free(marks);
+}
+
+gboolean steam_marks_load(SteamMarks *marks, GError **err)
+{
+    SteamMark  *mark;
+    GError     *ferr;
+    gchar     **lines;
+    gchar     **toks;
+    gchar      *data;
+    guint       i;
+
+    g_return_val_if_fail(marks != NULL, FALSE);
+
+    ferr = NULL;
+
+    if (!g_file_get_contents(marks->path, &data, NULL, &ferr)) {
+        /* A missing index only means nothing was delivered yet */
+        if (g_error_matches(ferr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_error_free(ferr);
+            return TRUE;
+        }
+
+        g_propagate_error(err, ferr);
+        return FALSE;
+    }
+
+    lines = g_strsplit(data, "\n", 0);
+    g_free(data);
+
+    for (i = 0; lines[i] != NULL; i++) {
+        if (lines[i][0] == 0)
+            continue;
+
+        toks = g_strsplit(lines[i], " ", 4);
+
+        if (g_strv_length(toks) != 4) {
+            g_set_error(err, STEAM_MARK_ERROR, STEAM_MARK_ERROR_PARSE,
+                        "%s: malformed line %u", marks->path, i + 1);
+            g_strfreev(toks);
+            g_strfreev(lines);
+            return FALSE;
+        }
+
+        mark = g_new0(SteamMark, 1);
+        mark->checked = g_ascii_strtoll(toks[1], NULL, 10);
+        mark->tstamp  = g_ascii_strtoll(toks[2], NULL, 10);
+        mark->hash    = g_ascii_strtoull(toks[3], NULL, 16);
+
+        g_hash_table_replace(marks->marks, g_strdup(toks[0]), mark);
+        g_strfreev(toks);
+    }
+
+    g_strfreev(lines);
+    return TRUE;
+}
+
+gboolean steam_marks_save(SteamMarks *marks, GError **err)
+{
+    GHashTableIter  iter;
+    SteamMark      *mark;
+    GString        *gstr;
+    gchar          *steamid;
+    gboolean        ret;
+
+    g_return_val_if_fail(marks != NULL, FALSE);
+
+    gstr = g_string_sized_new(g_hash_table_size(marks->marks) * 48);
+    g_hash_table_iter_init(&iter, marks->marks);
+
+    while (g_hash_table_iter_next(&iter, (gpointer *) &steamid,
+                                  (gpointer *) &mark))
+    {
+        /* History seen live is complete up to the last poll */
+        if (mark->live && (marks->synced > mark->checked))
+            mark->checked = marks->synced;
+
+        g_string_append_printf(gstr, "%s %" G_GINT64_FORMAT " %"
+                               G_GINT64_FORMAT " %08x\n", steamid,
+                               mark->checked, mark->tstamp, mark->hash);
+    }
+
+    ret = g_file_set_contents(marks->path, gstr->str, gstr->len, err);
+    g_string_free(gstr, TRUE);
+    return ret;
+}
+
+static gboolean steam_marks_save_cb(gpointer data, gint fd,
+                                    b_input_condition cond)
+{
+    SteamMarks *marks = data;
+
+    marks->ev = 0;
+
+    /* A failed write is retried along with the next change */
+    steam_marks_save(marks, NULL);
+    return FALSE;
+}
+
+static void steam_marks_dirty(SteamMarks *marks)
+{
+    if (marks->ev == 0)
+        marks->ev = b_timeout_add(STEAM_MARK_SAVE, steam_marks_save_cb, marks);
+}
+
+SteamMark *steam_marks_get(SteamMarks *marks, const gchar *steamid)
+{
+    g_return_val_if_fail(marks   != NULL, NULL);
+    g_return_val_if_fail(steamid != NULL, NULL);
+
+    return g_hash_table_lookup(marks->marks, steamid);
+}
+
+static SteamMark *steam_marks_ensure(SteamMarks *marks, const gchar *steamid)
+{
+    SteamMark *mark;
+
+    mark = g_hash_table_lookup(marks->marks, steamid);
+
+    if (mark == NULL) {
+        mark = g_new0(SteamMark, 1);
+        g_hash_table_insert(marks->marks, g_strdup(steamid), mark);
+    }
+
+    return mark;
+}
+
+void steam_marks_deliver(SteamMarks *marks, const gchar *steamid,
+                         gint64 tstamp, const gchar *text)
+{
+    SteamMark *mark;
+
+    g_return_if_fail(marks   != NULL);
+    g_return_if_fail(steamid != NULL);
+
+    mark = steam_marks_ensure(marks, steamid);
+
+    if (tstamp < mark->tstamp)
+        return;
+
+    mark->tstamp = tstamp;
+    mark->hash   = steam_mark_hash(text);
+    steam_marks_dirty(marks);
+}
+
+void steam_marks_live(SteamMarks *marks, const gchar *steamid)
+{
+    SteamMark *mark;
+
+    g_return_if_fail(marks   != NULL);
+    g_return_if_fail(steamid != NULL);
+
+    mark = steam_marks_ensure(marks, steamid);
+
+    if (!mark->live) {
+        mark->live = TRUE;
+        steam_marks_dirty(marks);
+    }
+}
+
+void steam_marks_sync(SteamMarks *marks, gint64 synced)
+{
+    g_return_if_fail(marks != NULL);
+
+    if (synced > marks->synced)
+        marks->synced = synced;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STEAM_MARK_H
+#define _STEAM_MARK_H
+
+#include <bitlbee.h>
+
+#define STEAM_MARK_ERROR steam_mark_error_quark()
+
+#define STEAM_MARK_SAVE 60000
+
+typedef enum   _SteamMarkError SteamMarkError;
+typedef struct _SteamMark      SteamMark;
+typedef struct _SteamMarks     SteamMarks;
+
+enum _SteamMarkError
+{
+    STEAM_MARK_ERROR_PARSE = 0
+};
+
+struct _SteamMark
+{
+    gint64  checked;
+    gint64  tstamp;
+    guint32 hash;
+
+    gboolean live;
+};
+
+struct _SteamMarks
+{
+    gchar      *path;
+    GHashTable *marks;
+    gint64      synced;
+    gint        ev;
+};
+
+GQuark steam_mark_error_quark(void);
+
+guint32 steam_mark_hash(const gchar *text);
+
+SteamMarks *steam_marks_new(const gchar *path);
+
+void steam_marks_free(SteamMarks *marks);
+
+gboolean steam_marks_load(SteamMarks *marks, GError **err);
+
+gboolean steam_marks_save(SteamMarks *marks, GError **err);
+
+SteamMark *steam_marks_get(SteamMarks *marks, const gchar *steamid);
+
+void steam_marks_deliver(SteamMarks *marks, const gchar *steamid,
+                         gint64 tstamp, const gchar *text);
+
+void steam_marks_live(SteamMarks *marks, const gchar *steamid);
+
+void steam_marks_sync(SteamMarks *marks, gint64 synced);
+
+#endif /* _STEAM_MARK_H */
@@ -0,0 +1,391 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "steam-api.h"
+#include "steam-mock.h"
+
+GQuark steam_mock_error_quark(void)
+{
+    static GQuark q;
+
+    if (G_UNLIKELY(q == 0))
+        q = g_quark_from_static_string("steam-mock-error-quark");
+
+    return q;
+}
+
+static const gchar *steam_mock_param(SteamHttpReq *req, const gchar *key)
+{
+    guint i;
+
+    for (i = 0; i < req->params.size; i++) {
+        if (g_strcmp0(req->params.pairs[i].key, key) == 0)
+            return req->params.pairs[i].val;
+    }
+
+    return NULL;
+}
+
+static gint64 steam_mock_friend(SteamMock *mock)
+{
+    return STEAM_MOCK_STEAMID + 1 + g_rand_int_range(mock->rand, 0,
+                                                     mock->friends);
+}
+
+static void steam_mock_key(SteamMock *mock, GString *gstr)
+{
+    gchar mod[257];
+
+    /* Any odd modulus will do, nothing ever decrypts the password */
+    memset(mod, 'f', sizeof mod - 1);
+    mod[sizeof mod - 1] = 0;
+
+    g_string_append_printf(gstr, "{\"success\":true,\"publickey_mod\":\"%s\","
+                                 "\"publickey_exp\":\"010001\","
+                                 "\"timestamp\":\"1\"}", mod);
+}
+
+static void steam_mock_auth(SteamMock *mock, GString *gstr)
+{
+    g_string_append_printf(gstr, "{\"success\":true,\"oauth\":\"{"
+                                 "\\\"steamid\\\":\\\"%" G_GINT64_FORMAT
+                                 "\\\","
+                                 "\\\"oauth_token\\\":\\\"mock\\\"}\"}",
+                           (gint64) STEAM_MOCK_STEAMID);
+}
+
+static void steam_mock_logon(SteamMock *mock, GString *gstr)
+{
+    g_string_append_printf(gstr, "{\"error\":\"OK\",\"message\":%"
+                                 G_GINT64_FORMAT ",\"utc_timestamp\":%"
+                                 G_GINT64_FORMAT ",\"steamid\":\"%"
+                                 G_GINT64_FORMAT "\",\"umqid\":\"mock\"}",
+                           mock->lmid, (gint64) time(NULL),
+                           (gint64) STEAM_MOCK_STEAMID);
+}
+
+static void steam_mock_friends(SteamMock *mock, GString *gstr)
+{
+    guint i;
+
+    g_string_append(gstr, "{\"friends\":[");
+
+    for (i = 0; i < mock->friends; i++) {
+        g_string_append_printf(gstr, "%s{\"steamid\":\"%" G_GINT64_FORMAT
+                                     "\",\"relationship\":\"friend\"}",
+                               (i > 0) ? "," : "",
+                               (gint64) STEAM_MOCK_STEAMID + 1 + i);
+    }
+
+    g_string_append(gstr, "]}");
+}
+
+static void steam_mock_summaries(SteamMock *mock, SteamHttpReq *req,
+                                 GString *gstr)
+{
+    const gchar  *str;
+    gchar       **ids;
+    guint         i;
+
+    str = steam_mock_param(req, "steamids");
+    ids = g_strsplit((str != NULL) ? str : "", ",", 0);
+
+    g_string_append(gstr, "{\"players\":[");
+
+    for (i = 0; ids[i] != NULL; i++) {
+        g_string_append_printf(gstr, "%s{\"steamid\":\"%s\","
+                                     "\"personaname\":\"Mock %s\","
+                                     "\"personastate\":%d}",
+                               (i > 0) ? "," : "", ids[i], ids[i],
+                               g_rand_int_range(mock->rand, 0, 2));
+    }
+
+    g_string_append(gstr, "]}");
+    g_strfreev(ids);
+}
+
+static void steam_mock_poll(SteamMock *mock, GString *gstr)
+{
+    gint64 tstamp;
+    guint  size;
+    guint  i;
+
+    size   = mock->rate + mock->churn;
+    tstamp = time(NULL);
+
+    if (size > 0)
+        mock->lmid += size;
+
+    g_string_append_printf(gstr, "{\"error\":\"%s\",\"sectimeout\":%d,"
+                                 "\"messagelast\":%" G_GINT64_FORMAT ","
+                                 "\"messages\":[",
+                           (size > 0) ? "OK" : "Timeout", STEAM_API_TIMEOUT,
+                           mock->lmid);
+
+    for (i = 0; i < size; i++) {
+        g_string_append_printf(gstr, "%s{\"steamid_from\":\"%"
+                                     G_GINT64_FORMAT "\",\"utc_timestamp\":%"
+                                     G_GINT64_FORMAT ",",
+                               (i > 0) ? "," : "", steam_mock_friend(mock),
+                               tstamp);
+
+        if (i < mock->rate) {
+            g_string_append_printf(gstr, "\"type\":\"saytext\","
+                                         "\"text\":\"Mock message %u\"}", i);
+        } else {
+            g_string_append_printf(gstr, "\"type\":\"personastate\","
+                                         "\"persona_name\":\"Mock %u\"}",
+                                   g_rand_int(mock->rand));
+        }
+    }
+
+    g_string_append(gstr, "]}");
+}
+
+static gboolean steam_mock_fault(SteamMock *mock, SteamHttpReq *req)
+{
+    static const gchar *nlo = "{\"error\":\"Not Logged On\"}";
+
+    SteamMockFault fault;
+
+    if ((mock->faults == 0) ||
+        (g_rand_int_range(mock->rand, 0, 100) >= (gint32) mock->faults))
+    {
+        return FALSE;
+    }
+
+    fault = g_rand_int_range(mock->rand, 0, STEAM_MOCK_FAULT_LAST);
+
+    /* Only the presence endpoints know about expired sessions */
+    if ((fault == STEAM_MOCK_FAULT_LOGGED_OFF) &&
+        (g_strcmp0(req->path, STEAM_API_PATH_POLL)    != 0) &&
+        (g_strcmp0(req->path, STEAM_API_PATH_MESSAGE) != 0))
+    {
+        fault = STEAM_MOCK_FAULT_SERVER;
+    }
+
+    switch (fault) {
+    case STEAM_MOCK_FAULT_LOGGED_OFF:
+        steam_http_req_reply(req, 200, "HTTP/1.1 200 OK\r\n", nlo,
+                             strlen(nlo));
+        return TRUE;
+
+    case STEAM_MOCK_FAULT_SERVER:
+        steam_http_req_reply(req, 503, "HTTP/1.1 503 Service Unavailable\r\n",
+                             "", 0);
+        return TRUE;
+
+    default:
+        /* Never answered, left to the request's own timeout */
+        return TRUE;
+    }
+}
+
+static void steam_mock_reply(SteamMock *mock, SteamHttpReq *req)
+{
+    const gchar *header;
+    GString     *gstr;
+
+    if (steam_mock_fault(mock, req))
+        return;
+
+    header = "HTTP/1.1 200 OK\r\n";
+    gstr   = g_string_sized_new(1024);
+
+    if (g_strcmp0(req->path, STEAM_COM_PATH_KEY) == 0) {
+        steam_mock_key(mock, gstr);
+    } else if (g_strcmp0(req->path, STEAM_COM_PATH_AUTH) == 0) {
+        steam_mock_auth(mock, gstr);
+    } else if (g_strcmp0(req->path, STEAM_COM_PATH_AUTH_RDIR) == 0) {
+        header = "HTTP/1.1 200 OK\r\n"
+                 "Set-Cookie: sessionid=mock; path=/\r\n";
+    } else if (g_strcmp0(req->path, STEAM_API_PATH_LOGON) == 0) {
+        steam_mock_logon(mock, gstr);
+    } else if (g_strcmp0(req->path, STEAM_API_PATH_FRIENDS) == 0) {
+        steam_mock_friends(mock, gstr);
+    } else if (g_strcmp0(req->path, STEAM_API_PATH_SUMMARIES) == 0) {
+        steam_mock_summaries(mock, req, gstr);
+    } else if (g_strcmp0(req->path, STEAM_API_PATH_POLL) == 0) {
+        steam_mock_poll(mock, gstr);
+    } else if (g_strcmp0(req->path, STEAM_API_PATH_FRIEND_SEARCH) == 0) {
+        g_string_append(gstr, "{\"results\":[]}");
+    } else if (g_str_has_prefix(req->path, STEAM_COM_PATH_CHATLOG)) {
+        g_string_append(gstr, "[]");
+    } else if (g_strcmp0(req->path, STEAM_COM_PATH_FRIEND_REMOVE) == 0) {
+        g_string_append(gstr, "true");
+    } else {
+        /* Logoff, messages and the remaining friend actions */
+        g_string_append(gstr, "{\"error\":\"OK\",\"error_text\":\"\"}");
+    }
+
+    steam_http_req_reply(req, 200, header, gstr->str, gstr->len);
+    g_string_free(gstr, TRUE);
+}
+
+static void steam_mock_pend_free(SteamMockPend *pend)
+{
+    if (pend->ev > 0)
+        b_event_remove(pend->ev);
+
+    g_free(pend);
+}
+
+static gboolean steam_mock_serve_cb(gpointer data, gint fd,
+                                    b_input_condition cond)
+{
+    SteamMockPend *pend = data;
+    SteamMock     *mock = pend->mock;
+    SteamHttpReq  *req;
+
+    req = steam_http_req_lookup(mock->http, pend->id);
+
+    /* Finishing the request calls back into steam_mock_cancel() */
+    pend->ev = 0;
+    g_hash_table_remove(mock->pends, GUINT_TO_POINTER(pend->id));
+
+    if (req != NULL)
+        steam_mock_reply(mock, req);
+
+    return FALSE;
+}
+
+static void steam_mock_send(SteamHttpReq *req, gpointer data)
+{
+    SteamMock     *mock = data;
+    SteamMockPend *pend;
+    guint          ms;
+
+    pend = g_new0(SteamMockPend, 1);
+    pend->mock = mock;
+    pend->id   = req->id;
+
+    /* Polls are held like the real long poll, or would spin */
+    if (g_strcmp0(req->path, STEAM_API_PATH_POLL) == 0)
+        ms = MAX(mock->latency, mock->poll);
+    else
+        ms = mock->latency;
+
+    pend->ev = b_timeout_add(ms, steam_mock_serve_cb, pend);
+    g_hash_table_replace(mock->pends, GUINT_TO_POINTER(pend->id), pend);
+}
+
+static void steam_mock_cancel(SteamHttpReq *req, gpointer data)
+{
+    SteamMock *mock = data;
+
+    g_hash_table_remove(mock->pends, GUINT_TO_POINTER(req->id));
+}
+
+static void steam_mock_free(gpointer data)
+{
+    SteamMock *mock = data;
+
+    g_hash_table_destroy(mock->pends);
+    g_rand_free(mock->rand);
+    g_free(mock);
+}
+
+static const SteamHttpTransport steam_mock_transport = {
+    steam_mock_send,
+    steam_mock_cancel,
+    NULL,
+    steam_mock_free
+};
+
+static gboolean steam_mock_parse(SteamMock *mock, const gchar *spec,
+                                 GError **err)
+{
+    gchar  **opts;
+    gchar  **kv;
+    gchar   *end;
+    guint   *val;
+    guint64  in;
+    guint    i;
+
+    opts = g_strsplit(spec, ",", 0);
+
+    for (i = 0; opts[i] != NULL; i++) {
+        if (*g_strstrip(opts[i]) == 0)
+            continue;
+
+        kv = g_strsplit(opts[i], "=", 2);
+
+        if (g_strcmp0(kv[0], "friends") == 0)
+            val = &mock->friends;
+        else if (g_strcmp0(kv[0], "rate") == 0)
+            val = &mock->rate;
+        else if (g_strcmp0(kv[0], "churn") == 0)
+            val = &mock->churn;
+        else if (g_strcmp0(kv[0], "faults") == 0)
+            val = &mock->faults;
+        else if (g_strcmp0(kv[0], "latency") == 0)
+            val = &mock->latency;
+        else if (g_strcmp0(kv[0], "poll") == 0)
+            val = &mock->poll;
+        else
+            val = NULL;
+
+        in = (kv[1] != NULL) ? g_ascii_strtoull(kv[1], &end, 10) : 0;
+
+        if ((val == NULL) || (kv[1] == NULL) || (*kv[1] == 0) ||
+            (*end != 0) || (in > G_MAXINT))
+        {
+            g_set_error(err, STEAM_MOCK_ERROR, STEAM_MOCK_ERROR_SPEC,
+                        "Invalid mock option: %s", opts[i]);
+            g_strfreev(kv);
+            g_strfreev(opts);
+            return FALSE;
+        }
+
+        *val = in;
+        g_strfreev(kv);
+    }
+
+    g_strfreev(opts);
+    mock->friends = MAX(mock->friends, 1);
+    mock->faults  = MIN(mock->faults, 100);
+    return TRUE;
+}
+
+gboolean steam_mock_set(SteamHttp *http, const gchar *spec, GError **err)
+{
+    SteamMock *mock;
+
+    g_return_val_if_fail(http != NULL, FALSE);
+    g_return_val_if_fail(spec != NULL, FALSE);
+
+    mock = g_new0(SteamMock, 1);
+    mock->http    = http;
+    mock->rand    = g_rand_new();
+    mock->lmid    = 1;
+    mock->friends = STEAM_MOCK_FRIENDS;
+    mock->poll    = STEAM_MOCK_POLL;
+
+    mock->pends = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                        (GDestroyNotify) steam_mock_pend_free);
+
+    if (!steam_mock_parse(mock, spec, err)) {
+        steam_mock_free(mock);
+        return FALSE;
+    }
+
+    steam_http_transport_set(http, &steam_mock_transport, mock);
+    return TRUE;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STEAM_MOCK_H
+#define _STEAM_MOCK_H
+
+#include <bitlbee.h>
+
+#include "steam-http.h"
+
+#define STEAM_MOCK_ERROR steam_mock_error_quark()
+
+#define STEAM_MOCK_FRIENDS 100
+#define STEAM_MOCK_POLL    1000
+#define STEAM_MOCK_STEAMID 76561197960265729
+
+typedef enum   _SteamMockError SteamMockError;
+typedef enum   _SteamMockFault SteamMockFault;
+typedef struct _SteamMock      SteamMock;
+typedef struct _SteamMockPend  SteamMockPend;
+
+enum _SteamMockError
+{
+    STEAM_MOCK_ERROR_SPEC = 0
+};
+
+enum _SteamMockFault
+{
+    STEAM_MOCK_FAULT_LOGGED_OFF = 0,
+    STEAM_MOCK_FAULT_SERVER,
+    STEAM_MOCK_FAULT_TIMEOUT,
+
+    STEAM_MOCK_FAULT_LAST
+};
+
+struct _SteamMock
+{
+    SteamHttp  *http;
+    GRand      *rand;
+    GHashTable *pends;
+    gint64      lmid;
+
+    guint friends;
+    guint rate;
+    guint churn;
+    guint faults;
+    guint latency;
+    guint poll;
+};
+
+struct _SteamMockPend
+{
+    SteamMock *mock;
+
+    guint id;
+    gint  ev;
+};
+
+GQuark steam_mock_error_quark(void);
+
+gboolean steam_mock_set(SteamHttp *http, const gchar *spec, GError **err);
+
+#endif /* _STEAM_MOCK_H */
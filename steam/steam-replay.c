@@ -0,0 +1,378 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "steam-replay.h"
+
+GQuark steam_replay_error_quark(void)
+{
+    static GQuark q;
+
+    if (G_UNLIKELY(q == 0))
+        q = g_quark_from_static_string("steam-replay-error-quark");
+
+    return q;
+}
+
+static gchar *steam_replay_key(SteamHttpReq *req)
+{
+    gchar m;
+
+    m = (req->flags & STEAM_HTTP_REQ_FLAG_POST) ? 'P' : 'G';
+    return g_strdup_printf("%c %s:%d%s", m, req->host, req->port, req->path);
+}
+
+static gchar *steam_replay_path(const gchar *name, GError **err)
+{
+    gchar    **parts;
+    gboolean   up;
+    guint      i;
+
+    parts = g_strsplit_set(name, "/\\", 0);
+    up    = FALSE;
+
+    for (i = 0; parts[i] != NULL; i++)
+        up |= (strcmp(parts[i], "..") == 0);
+
+    g_strfreev(parts);
+
+    /* Account settings must not reach outside of the daemon's files */
+    if ((*name == 0) || g_path_is_absolute(name) || up) {
+        g_set_error(err, STEAM_REPLAY_ERROR, STEAM_REPLAY_ERROR_PATH,
+                    "%s: Must be relative to the configuration directory",
+                    name);
+        return NULL;
+    }
+
+    return g_build_filename(global.conf->configdir, name, NULL);
+}
+
+static void steam_replay_rec_free(SteamReplayRec *rec)
+{
+    g_free(rec->header);
+    g_free(rec->body);
+    g_free(rec);
+}
+
+static void steam_replay_recs_free(gpointer data)
+{
+    GQueue *recs = data;
+
+    g_queue_foreach(recs, (GFunc) steam_replay_rec_free, NULL);
+    g_queue_free(recs);
+}
+
+static void steam_replay_pend_free(gpointer data)
+{
+    SteamReplayPend *pend = data;
+
+    if (pend->ev > 0)
+        b_event_remove(pend->ev);
+
+    g_free(pend);
+}
+
+static SteamReplay *steam_replay_new(SteamHttp *http)
+{
+    SteamReplay *rply;
+
+    rply = g_new0(SteamReplay, 1);
+    rply->http  = http;
+    rply->recs  = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        steam_replay_recs_free);
+    rply->pends = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                        steam_replay_pend_free);
+
+    return rply;
+}
+
+static void steam_replay_free(gpointer data)
+{
+    SteamReplay *rply = data;
+
+    if (rply->file != NULL)
+        fclose(rply->file);
+
+    g_hash_table_destroy(rply->pends);
+    g_hash_table_destroy(rply->recs);
+    g_free(rply);
+}
+
+static void steam_replay_record_reply(SteamHttpReq *req, gpointer data)
+{
+    SteamReplay *rply = data;
+    gchar       *buf;
+    gchar       *key;
+    gint64       elapsed;
+    gsize        hsize;
+    gsize        size;
+
+    elapsed = 0;
+    hsize   = (req->header != NULL) ? strlen(req->header) : 0;
+
+    if ((req->marks != NULL) && (req->marks[STEAM_HTTP_MARK_DISPATCH] != 0)) {
+        elapsed = req->marks[STEAM_HTTP_MARK_DONE] -
+                  req->marks[STEAM_HTTP_MARK_DISPATCH];
+    }
+
+    key = steam_replay_key(req);
+    fprintf(rply->file, "%s %d %" G_GINT64_FORMAT " %" G_GSIZE_FORMAT " %d\n",
+            key, req->status, elapsed, hsize, req->body_size);
+
+    size = hsize + req->body_size;
+
+    /* Recordings are plain files, keep the credentials out of them */
+    if (size > 0) {
+        buf = g_malloc(size);
+
+        if (hsize > 0)
+            memcpy(buf, req->header, hsize);
+
+        if (req->body_size > 0)
+            memcpy(buf + hsize, req->body, req->body_size);
+
+        steam_http_trace_redact(buf, size);
+        fwrite(buf, 1, size, rply->file);
+        g_free(buf);
+    }
+
+    fputc('\n', rply->file);
+    fflush(rply->file);
+    g_free(key);
+}
+
+static const SteamHttpTransport steam_replay_recorder = {
+    NULL,
+    NULL,
+    steam_replay_record_reply,
+    steam_replay_free
+};
+
+gboolean steam_replay_record(SteamHttp *http, const gchar *path, GError **err)
+{
+    SteamReplay *rply;
+    FILE        *file;
+    gchar       *fpath;
+
+    g_return_val_if_fail(http != NULL, FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    fpath = steam_replay_path(path, err);
+
+    if (fpath == NULL)
+        return FALSE;
+
+    file = fopen(fpath, "ab");
+
+    if (file == NULL) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "%s: %s", path, g_strerror(errno));
+        g_free(fpath);
+        return FALSE;
+    }
+
+    g_free(fpath);
+
+    rply = steam_replay_new(http);
+    rply->file = file;
+
+    steam_http_transport_set(http, &steam_replay_recorder, rply);
+    return TRUE;
+}
+
+static gboolean steam_replay_parse(SteamReplay *rply, const gchar *data,
+                                   gsize size, GError **err)
+{
+    SteamReplayRec  *rec;
+    const gchar     *pos;
+    const gchar     *end;
+    const gchar     *nl;
+    GQueue          *recs;
+    gchar          **toks;
+    gchar           *line;
+    gchar           *key;
+    gsize            hsize;
+
+    pos = data;
+    end = data + size;
+
+    while (pos < end) {
+        nl   = memchr(pos, '\n', end - pos);
+        line = g_strndup(pos, (nl != NULL) ? (gsize) (nl - pos) : 0);
+        toks = g_strsplit(line, " ", 6);
+        g_free(line);
+
+        if ((nl == NULL) || (g_strv_length(toks) != 6)) {
+            g_set_error(err, STEAM_REPLAY_ERROR, STEAM_REPLAY_ERROR_PARSE,
+                        "Malformed record at offset %" G_GSIZE_FORMAT,
+                        (gsize) (pos - data));
+            g_strfreev(toks);
+            return FALSE;
+        }
+
+        pos   = nl + 1;
+        hsize = g_ascii_strtoull(toks[4], NULL, 10);
+
+        rec = g_new0(SteamReplayRec, 1);
+        rec->status  = g_ascii_strtoll(toks[2], NULL, 10);
+        rec->elapsed = g_ascii_strtoll(toks[3], NULL, 10);
+        rec->size    = g_ascii_strtoull(toks[5], NULL, 10);
+
+        if ((hsize > (gsize) (end - pos)) ||
+            (rec->size >= (gsize) (end - pos) - hsize))
+        {
+            g_set_error(err, STEAM_REPLAY_ERROR, STEAM_REPLAY_ERROR_PARSE,
+                        "Truncated record for %s %s", toks[0], toks[1]);
+            steam_replay_rec_free(rec);
+            g_strfreev(toks);
+            return FALSE;
+        }
+
+        rec->header = g_strndup(pos, hsize);
+        rec->body   = g_malloc(rec->size + 1);
+
+        memcpy(rec->body, pos + hsize, rec->size);
+        rec->body[rec->size] = 0;
+        pos += hsize + rec->size + 1;
+
+        key  = g_strdup_printf("%s %s", toks[0], toks[1]);
+        recs = g_hash_table_lookup(rply->recs, key);
+
+        if (recs == NULL) {
+            recs = g_queue_new();
+            g_hash_table_insert(rply->recs, key, recs);
+        } else {
+            g_free(key);
+        }
+
+        g_queue_push_tail(recs, rec);
+        g_strfreev(toks);
+    }
+
+    return TRUE;
+}
+
+static gboolean steam_replay_serve_cb(gpointer data, gint fd,
+                                      b_input_condition cond)
+{
+    SteamReplayPend *pend = data;
+    SteamReplayRec  *rec  = pend->rec;
+    SteamHttpReq    *req;
+
+    req = steam_http_req_lookup(pend->rply->http, pend->id);
+
+    /* Finishing the request calls back into steam_replay_cancel() */
+    pend->ev = 0;
+    g_hash_table_remove(pend->rply->pends, GUINT_TO_POINTER(pend->id));
+
+    if (req == NULL)
+        return FALSE;
+
+    if (rec == NULL) {
+        steam_http_req_fail(req, "No recorded reply");
+        return FALSE;
+    }
+
+    steam_http_req_reply(req, rec->status, rec->header, rec->body, rec->size);
+    return FALSE;
+}
+
+static void steam_replay_send(SteamHttpReq *req, gpointer data)
+{
+    SteamReplay     *rply = data;
+    SteamReplayPend *pend;
+    GQueue          *recs;
+    gchar           *key;
+    gint             ms;
+
+    key  = steam_replay_key(req);
+    recs = g_hash_table_lookup(rply->recs, key);
+    g_free(key);
+
+    pend = g_new0(SteamReplayPend, 1);
+    pend->rply = rply;
+    pend->id   = req->id;
+
+    /* Cycle through the replies recorded for the same endpoint */
+    if (recs != NULL) {
+        pend->rec = g_queue_pop_head(recs);
+        g_queue_push_tail(recs, pend->rec);
+    }
+
+    if (rply->latency >= 0)
+        ms = rply->latency;
+    else if (pend->rec != NULL)
+        ms = pend->rec->elapsed / 1000;
+    else
+        ms = 0;
+
+    pend->ev = b_timeout_add(ms, steam_replay_serve_cb, pend);
+    g_hash_table_replace(rply->pends, GUINT_TO_POINTER(pend->id), pend);
+}
+
+static void steam_replay_cancel(SteamHttpReq *req, gpointer data)
+{
+    SteamReplay *rply = data;
+
+    g_hash_table_remove(rply->pends, GUINT_TO_POINTER(req->id));
+}
+
+static const SteamHttpTransport steam_replay_replayer = {
+    steam_replay_send,
+    steam_replay_cancel,
+    NULL,
+    steam_replay_free
+};
+
+gboolean steam_replay_replay(SteamHttp *http, const gchar *path, gint latency,
+                             GError **err)
+{
+    SteamReplay *rply;
+    gchar       *fpath;
+    gchar       *data;
+    gsize        size;
+
+    g_return_val_if_fail(http != NULL, FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    fpath = steam_replay_path(path, err);
+
+    if (fpath == NULL)
+        return FALSE;
+
+    if (!g_file_get_contents(fpath, &data, &size, err)) {
+        g_free(fpath);
+        return FALSE;
+    }
+
+    g_free(fpath);
+
+    rply = steam_replay_new(http);
+    rply->latency = latency;
+
+    if (!steam_replay_parse(rply, data, size, err)) {
+        steam_replay_free(rply);
+        g_free(data);
+        return FALSE;
+    }
+
+    g_free(data);
+    steam_http_transport_set(http, &steam_replay_replayer, rply);
+    return TRUE;
+}
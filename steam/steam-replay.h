@@ -0,0 +1,75 @@
+/*
+ * Copyright 2012-2013 James Geboski <jgeboski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STEAM_REPLAY_H
+#define _STEAM_REPLAY_H
+
+#include <bitlbee.h>
+#include <stdio.h>
+
+#include "steam-http.h"
+
+#define STEAM_REPLAY_ERROR steam_replay_error_quark()
+
+typedef enum   _SteamReplayError SteamReplayError;
+typedef struct _SteamReplay      SteamReplay;
+typedef struct _SteamReplayPend  SteamReplayPend;
+typedef struct _SteamReplayRec   SteamReplayRec;
+
+enum _SteamReplayError
+{
+    STEAM_REPLAY_ERROR_PARSE = 0,
+    STEAM_REPLAY_ERROR_PATH
+};
+
+struct _SteamReplay
+{
+    SteamHttp  *http;
+    FILE       *file;
+    gint        latency;
+
+    GHashTable *recs;
+    GHashTable *pends;
+};
+
+struct _SteamReplayPend
+{
+    SteamReplay    *rply;
+    SteamReplayRec *rec;
+
+    guint id;
+    gint  ev;
+};
+
+struct _SteamReplayRec
+{
+    gint    status;
+    gint64  elapsed;
+
+    gchar  *header;
+    gchar  *body;
+    gsize   size;
+};
+
+GQuark steam_replay_error_quark(void);
+
+gboolean steam_replay_record(SteamHttp *http, const gchar *path, GError **err);
+
+gboolean steam_replay_replay(SteamHttp *http, const gchar *path, gint latency,
+                             GError **err);
+
+#endif /* _STEAM_REPLAY_H */
@@ -20,6 +20,10 @@
 
 #include "steam.h"
 #include "steam-glib.h"
+#ifdef DEBUG
+#include "steam-mock.h"
+#include "steam-replay.h"
+#endif
 
 static void steam_logon(SteamApi *api, GError *err, gpointer data);
 static void steam_poll(SteamApi *api, GSList *messages, GError *err,
@@ -27,10 +31,102 @@ static void steam_poll(SteamApi *api, GSList *messages, GError *err,
 static void steam_summary_u(SteamApi *api, SteamFriendSummary *smry,
                             GError *err, gpointer data);
 
+static void steam_trace_log(const gchar *line, gpointer data)
+{
+    SteamData *sata = data;
+
+    imcb_log(sata->ic, "HTTP: %s", line);
+}
+
+static void steam_trace_apply(SteamData *sata, const gchar *value)
+{
+    gboolean error;
+
+    /* "error" also dumps the trace of every request which fails */
+    error = (g_ascii_strcasecmp(value, "error") == 0);
+    steam_http_trace_set(sata->api->http, error || bool2int((gchar *) value),
+                         error ? steam_trace_log : NULL, sata);
+}
+
+#ifdef DEBUG
+static void steam_transport_apply(SteamData *sata, account_t *acc)
+{
+    const gchar *str;
+    GError      *err = NULL;
+    gint         lat;
+
+    /* Synthetic replies take precedence, recording them is pointless */
+    if ((str = set_getstr(&acc->set, "http_mock")) != NULL) {
+        steam_mock_set(sata->api->http, str, &err);
+    } else if ((str = set_getstr(&acc->set, "http_replay")) != NULL) {
+        lat = set_getint(&acc->set, "http_replay_latency");
+        steam_replay_replay(sata->api->http, str, lat, &err);
+    } else if ((str = set_getstr(&acc->set, "http_record")) != NULL) {
+        steam_replay_record(sata->api->http, str, &err);
+    }
+
+    if (err != NULL) {
+        imcb_error(sata->ic, "HTTP transport: %s", err->message);
+        g_error_free(err);
+    }
+}
+
+static void steam_hosts_apply(SteamData *sata, account_t *acc)
+{
+    static const gchar *hosts[][2] = {
+        {"api_host", STEAM_API_HOST},
+        {"com_host", STEAM_COM_HOST}
+    };
+
+    const gchar *str;
+    guint        i;
+
+    for (i = 0; i < G_N_ELEMENTS(hosts); i++) {
+        str = set_getstr(&acc->set, hosts[i][0]);
+
+        if (!steam_api_host_set(sata->api, hosts[i][1], str))
+            imcb_error(sata->ic, "Invalid %s: %s", hosts[i][0], str);
+    }
+}
+#endif
+
+static gboolean steam_pace_parse(const gchar *value, gdouble *rate,
+                                 guint *burst)
+{
+    gchar   *end;
+    guint64  in;
+
+    *rate  = g_ascii_strtod(value, &end);
+    *burst = STEAM_HTTP_PACE_BURST;
+
+    if ((end == value) || (*rate < 0))
+        return FALSE;
+
+    if (*end == '/') {
+        value = end + 1;
+        in    = g_ascii_strtoull(value, &end, 10);
+
+        if ((end == value) || (in < 1) || (in > G_MAXINT))
+            return FALSE;
+
+        *burst = in;
+    }
+
+    return (*end == 0);
+}
+
+static void steam_chatlog_free(SteamChatlog *clog)
+{
+    g_free(clog->steamid);
+    g_free(clog);
+}
+
 SteamData *steam_data_new(account_t *acc)
 {
     SteamData *sata;
     gchar     *str;
+    gdouble    rate;
+    guint      burst;
 
     g_return_val_if_fail(acc != NULL, NULL);
 
@@ -47,10 +143,35 @@ SteamData *steam_data_new(account_t *acc)
     sata->api->sessid  = g_strdup(set_getstr(&acc->set, "sessid"));
     sata->tstamp       = set_getint(&acc->set, "tstamp");
     sata->game_status  = set_getbool(&acc->set, "game_status");
+    sata->clogmax      = set_getint(&acc->set, "backfill");
+
+    sata->clogs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        (GDestroyNotify) steam_chatlog_free);
+    sata->clogq = g_queue_new();
+    sata->clogd = g_queue_new();
 
     str = set_getstr(&acc->set, "show_playing");
     sata->show_playing = steam_friend_user_mode(str);
 
+    steam_http_queue_lanes(sata->api->http,
+                           set_getint(&acc->set, "send_lanes"));
+
+    str = set_getstr(&acc->set, "http_pace");
+
+    if (steam_pace_parse(str, &rate, &burst))
+        steam_http_pace_host(sata->api->http, rate, burst);
+
+    steam_http_stats_enable(sata->api->http,
+                            set_getbool(&acc->set, "http_stats"));
+
+    str = set_getstr(&acc->set, "http_trace");
+    steam_trace_apply(sata, str);
+
+#ifdef DEBUG
+    steam_transport_apply(sata, acc);
+    steam_hosts_apply(sata, acc);
+#endif
+
     return sata;
 }
 
@@ -58,7 +179,19 @@ void steam_data_free(SteamData *sata)
 {
     g_return_if_fail(sata != NULL);
 
+    if (sata->clogev > 0)
+        b_event_remove(sata->clogev);
+
+    if (sata->marks != NULL)
+        steam_marks_free(sata->marks);
+
+    if (sata->cache != NULL)
+        steam_cache_free(sata->cache);
+
     steam_api_free(sata->api);
+    g_queue_free(sata->clogd);
+    g_queue_free(sata->clogq);
+    g_hash_table_destroy(sata->clogs);
     g_free(sata);
 }
 
@@ -141,6 +274,8 @@ static void steam_poll_mesg(SteamData *sata, SteamApiMessage *mesg,
             str = g_strdup(mesg->text);
 
         imcb_buddy_msg(sata->ic, mesg->smry->steamid, str, 0, tstamp);
+        steam_marks_deliver(sata->marks, mesg->smry->steamid, mesg->tstamp,
+                            mesg->text);
         g_free(str);
         return;
 
@@ -167,6 +302,7 @@ static void steam_poll_mesg(SteamData *sata, SteamApiMessage *mesg,
         if (G_UNLIKELY(bu == NULL))
             return;
 
+        steam_cache_update(sata->cache, mesg->smry);
         steam_buddy_status(sata, mesg->smry, bu);
         return;
     }
@@ -175,6 +311,7 @@ relationship:
     switch (mesg->smry->action) {
     case STEAM_FRIEND_ACTION_REMOVE:
     case STEAM_FRIEND_ACTION_IGNORE:
+        steam_cache_remove(sata->cache, mesg->smry->steamid);
         imcb_remove_buddy(sata->ic, mesg->smry->steamid, NULL);
         return;
 
@@ -188,6 +325,7 @@ relationship:
         imcb_rename_buddy(sata->ic, mesg->smry->steamid, mesg->smry->fullname);
 
         bu = imcb_buddy_by_handle(sata->ic, mesg->smry->steamid);
+        steam_cache_update(sata->cache, mesg->smry);
         steam_buddy_status(sata, mesg->smry, bu);
         return;
 
@@ -235,24 +373,118 @@ static void steam_auth(SteamApi *api, GError *err, gpointer data)
     imc_logout(sata->ic, FALSE);
 }
 
+static void steam_chatlog_next(SteamData *sata);
+
+static gboolean steam_chatlog_idle_cb(gpointer data, gint fd,
+                                      b_input_condition cond)
+{
+    SteamData *sata = data;
+
+    sata->clogev = 0;
+    steam_chatlog_next(sata);
+    return FALSE;
+}
+
 static void steam_chatlog(SteamApi *api, GSList *messages, GError *err,
                           gpointer data)
 {
-    SteamData       *sata = data;
+    SteamChatlog    *clog = data;
+    SteamData       *sata = clog->sata;
     SteamApiMessage *mesg;
     GSList          *l;
+    gboolean         past;
 
-    if (err != NULL) {
+    if (err != NULL)
         imcb_error(sata->ic, "%s", err->message);
-        return;
-    }
+    else
+        steam_marks_live(sata->marks, clog->steamid);
 
-    for (l = messages; l != NULL; l = l->next) {
+    past = FALSE;
+
+    for (l = messages; (err == NULL) && (l != NULL); l = l->next) {
         mesg = l->data;
 
-        if (mesg->tstamp > sata->tstamp)
+        /* Within the watermark second, skip up to the marked message */
+        if (mesg->tstamp == clog->since) {
+            if (!past) {
+                past = (clog->hash != 0) &&
+                       (steam_mark_hash(mesg->text) == clog->hash);
+                continue;
+            }
+        } else if (mesg->tstamp < clog->since) {
+            continue;
+        }
+
+        /* Anything from the poll onwards was already delivered */
+        if ((clog->until < 1) || (mesg->tstamp < clog->until))
             steam_poll_mesg(sata, mesg, mesg->tstamp);
     }
+
+    sata->clogn--;
+    g_hash_table_remove(sata->clogs, clog->steamid);
+    steam_chatlog_next(sata);
+}
+
+static void steam_chatlog_next(SteamData *sata)
+{
+    SteamChatlog *clog;
+    gint64        idle;
+
+    while (sata->clogn < sata->clogmax) {
+        clog = g_queue_pop_head(sata->clogq);
+
+        /* Friends without any sign of traffic wait for a quiet moment */
+        if (clog == NULL) {
+            if (g_queue_is_empty(sata->clogd))
+                return;
+
+            idle = (g_get_monotonic_time() - sata->active) / 1000;
+
+            if (idle < (STEAM_CHATLOG_IDLE * 1000)) {
+                if (sata->clogev == 0) {
+                    idle = (STEAM_CHATLOG_IDLE * 1000) - idle;
+                    sata->clogev = b_timeout_add(idle, steam_chatlog_idle_cb,
+                                                 sata);
+                }
+
+                return;
+            }
+
+            clog = g_queue_pop_head(sata->clogd);
+        }
+
+        clog->busy = TRUE;
+        sata->clogn++;
+        steam_api_chatlog(sata->api, clog->steamid, steam_chatlog, clog);
+    }
+}
+
+static void steam_chatlog_urge(SteamData *sata, const gchar *steamid,
+                               gint64 until)
+{
+    SteamChatlog *clog;
+
+    clog = g_hash_table_lookup(sata->clogs, steamid);
+
+    if (clog == NULL)
+        return;
+
+    if ((until > 0) && ((clog->until < 1) || (until < clog->until)))
+        clog->until = until;
+
+    if (clog->busy || clog->urgent)
+        return;
+
+    clog->urgent = TRUE;
+    g_queue_remove(sata->clogd, clog);
+    g_queue_push_tail(sata->clogq, clog);
+    steam_chatlog_next(sata);
+}
+
+static void steam_chatlog_touch(SteamData *sata, const gchar *steamid)
+{
+    sata->active = g_get_monotonic_time();
+    steam_chatlog_urge(sata, steamid, 0);
 }
 
 static void steam_friend_action(SteamApi *api, gchar *steamid, GError *err,
@@ -319,14 +551,68 @@ static void steam_friend_search(SteamApi *api, GSList *results, GError *err,
     }
 }
 
+static gboolean steam_friend_apply(SteamData *sata, SteamFriendSummary *smry,
+                                   gboolean live)
+{
+    struct im_connection *ic = sata->ic;
+    bee_user_t           *bu;
+
+    imcb_add_buddy(ic, smry->steamid, NULL);
+    imcb_buddy_nick_hint(ic, smry->steamid, smry->nick);
+    imcb_rename_buddy(ic, smry->steamid, smry->fullname);
+
+    bu = bee_user_by_handle(ic->bee, ic, smry->steamid);
+
+    if (G_UNLIKELY(bu == NULL))
+        return FALSE;
+
+    switch (smry->relation) {
+    case STEAM_FRIEND_RELATION_FRIEND:
+        /* Cached presence may be hours old, leave it to the fresh one */
+        if (live)
+            steam_buddy_status(sata, smry, bu);
+        break;
+
+    case STEAM_FRIEND_RELATION_IGNORE:
+        if (g_slist_find_custom(ic->deny, bu->handle,
+                                (GCompareFunc) g_ascii_strcasecmp) == NULL)
+        {
+            ic->deny = g_slist_prepend(ic->deny, g_strdup(bu->handle));
+        }
+        break;
+    }
+
+    return TRUE;
+}
+
+static void steam_friends_cached(SteamData *sata)
+{
+    GHashTableIter  iter;
+    gpointer        smry;
+
+    if (g_hash_table_size(sata->cache->sums) < 1)
+        return;
+
+    /* Show the last known roster until the friends list is back */
+    imcb_connected(sata->ic);
+    g_hash_table_iter_init(&iter, sata->cache->sums);
+
+    while (g_hash_table_iter_next(&iter, NULL, &smry))
+        steam_friend_apply(sata, smry, FALSE);
+}
+
 static void steam_friends(SteamApi *api, GSList *friends, GError *err,
                           gpointer data)
 {
-    SteamData            *sata = data;
-    SteamFriendSummary   *smry;
-    struct im_connection *ic;
-    GSList               *l;
-    bee_user_t           *bu;
+    SteamData          *sata = data;
+    SteamFriendSummary *smry;
+    SteamChatlog       *clog;
+    SteamMark          *mark;
+    GHashTable         *fresh;
+    GList              *stale;
+    GList              *k;
+    GSList             *l;
+    GError             *cerr;
 
     if (err != NULL) {
         imcb_error(sata->ic, "%s", err->message);
@@ -334,34 +620,70 @@ static void steam_friends(SteamApi *api, GSList *friends, GError *err,
         return;
     }
 
-    imcb_connected(sata->ic);
+    if (!(sata->ic->flags & OPT_LOGGED_IN))
+        imcb_connected(sata->ic);
+
+    sata->active = g_get_monotonic_time();
+    fresh = g_hash_table_new(g_str_hash, g_str_equal);
 
     for (l = friends; l != NULL; l = l->next) {
         smry = l->data;
 
-        imcb_add_buddy(sata->ic, smry->steamid, NULL);
-        imcb_buddy_nick_hint(sata->ic, smry->steamid, smry->nick);
-        imcb_rename_buddy(sata->ic, smry->steamid, smry->fullname);
+        g_hash_table_add(fresh, smry->steamid);
+        steam_cache_update(sata->cache, smry);
 
-        bu = bee_user_by_handle(sata->ic->bee, sata->ic, smry->steamid);
+        if (!steam_friend_apply(sata, smry, TRUE))
+            continue;
 
-        if (G_UNLIKELY(bu == NULL))
+        if ((sata->clogmax < 1) ||
+            g_hash_table_lookup_extended(sata->clogs, smry->steamid,
+                                         NULL, NULL))
+        {
             continue;
+        }
 
-        switch (smry->relation) {
-        case STEAM_FRIEND_RELATION_FRIEND:
-            steam_buddy_status(sata, smry, bu);
-            break;
+        mark = steam_marks_get(sata->marks, smry->steamid);
 
-        case STEAM_FRIEND_RELATION_IGNORE:
-            ic = sata->ic;
-            ic->deny = g_slist_prepend(ic->deny, g_strdup(bu->handle));
-            break;
+        /* Nothing can have been said while the friend stayed offline */
+        if ((mark != NULL) && (smry->state == STEAM_FRIEND_STATE_OFFLINE) &&
+            (smry->lastoff > 0) && (smry->lastoff <= mark->checked))
+        {
+            steam_marks_live(sata->marks, smry->steamid);
+            continue;
         }
 
-        steam_api_chatlog(api, smry->steamid, steam_chatlog, sata);
+        /* Backfill is deferred until the friend shows signs of traffic */
+        clog = g_new0(SteamChatlog, 1);
+        clog->sata    = sata;
+        clog->steamid = g_strdup(smry->steamid);
+        clog->since   = (mark != NULL) ? mark->tstamp : sata->tstamp;
+        clog->hash    = (mark != NULL) ? mark->hash   : 0;
+
+        g_hash_table_insert(sata->clogs, clog->steamid, clog);
+        g_queue_push_tail(sata->clogd, clog);
     }
 
+    /* Drop the cached friends that are gone from the fresh list */
+    stale = g_hash_table_get_keys(sata->cache->sums);
+
+    for (k = stale; k != NULL; k = k->next) {
+        if (g_hash_table_contains(fresh, k->data))
+            continue;
+
+        imcb_remove_buddy(sata->ic, k->data, NULL);
+        steam_cache_remove(sata->cache, k->data);
+    }
+
+    g_list_free(stale);
+    g_hash_table_destroy(fresh);
+    cerr = NULL;
+
+    if (!steam_cache_save(sata->cache, &cerr)) {
+        imcb_error(sata->ic, "%s", cerr->message);
+        g_error_free(cerr);
+    }
+
+    steam_chatlog_next(sata);
     steam_api_poll(api, steam_poll, sata);
 }
 
@@ -397,6 +719,8 @@ static void steam_logon(SteamApi *api, GError *err, gpointer data)
 {
     SteamData *sata = data;
     account_t *acc;
+    GError    *merr;
+    gchar     *str;
 
     if (err != NULL) {
         imcb_error(sata->ic, "%s", err->message);
@@ -406,6 +730,37 @@ static void steam_logon(SteamApi *api, GError *err, gpointer data)
 
     acc = sata->ic->acc;
 
+    /* The watermark index lives next to the account settings */
+    if (sata->marks == NULL) {
+        str = g_strdup_printf("%s/steam-%s.marks", global.conf->configdir,
+                              api->steamid);
+        sata->marks = steam_marks_new(str);
+        merr = NULL;
+        g_free(str);
+
+        if (!steam_marks_load(sata->marks, &merr)) {
+            imcb_error(sata->ic, "%s", merr->message);
+            g_error_free(merr);
+        }
+    }
+
+    if (sata->cache == NULL) {
+        str = g_strdup_printf("%s/steam-%s.cache", global.conf->configdir,
+                              api->steamid);
+        sata->cache = steam_cache_new(str);
+        merr = NULL;
+        g_free(str);
+
+        if (!steam_cache_load(sata->cache, &merr)) {
+            imcb_error(sata->ic, "%s", merr->message);
+            g_error_free(merr);
+        }
+    }
+
+    /* Track the server clock, it is what the friend summaries use */
+    sata->clock = api->tstamp - (g_get_monotonic_time() / G_USEC_PER_SEC);
+    steam_marks_sync(sata->marks, api->tstamp);
+
     if (sata->tstamp < 1) {
         sata->tstamp = api->tstamp;
         set_setint(&acc->set, "tstamp", api->tstamp);
@@ -416,6 +771,7 @@ static void steam_logon(SteamApi *api, GError *err, gpointer data)
 
     imcb_log(sata->ic, "Requesting friends list");
     steam_api_refresh(api);
+    steam_friends_cached(sata);
     steam_api_friends(api, steam_friends, sata);
 }
 
@@ -485,12 +841,30 @@ static void steam_poll(SteamApi *api, GSList *messages, GError *err,
         if (mesg->tstamp > tstamp)
             tstamp = mesg->tstamp;
 
+        switch (mesg->type) {
+        case STEAM_API_MESSAGE_TYPE_SAYTEXT:
+        case STEAM_API_MESSAGE_TYPE_EMOTE:
+            steam_chatlog_urge(sata, mesg->smry->steamid, mesg->tstamp);
+            break;
+
+        case STEAM_API_MESSAGE_TYPE_TYPING:
+        case STEAM_API_MESSAGE_TYPE_LEFT_CONV:
+            steam_chatlog_urge(sata, mesg->smry->steamid, 0);
+            break;
+
+        default:
+            break;
+        }
+
         steam_poll_mesg(sata, mesg, 0);
     }
 
     if (tstamp > 0)
         set_setint(&sata->ic->acc->set, "tstamp", tstamp);
 
+    tstamp = sata->clock + (g_get_monotonic_time() / G_USEC_PER_SEC);
+    steam_marks_sync(sata->marks, tstamp);
+
     steam_api_poll(api, steam_poll, sata);
 }
 
@@ -615,6 +989,178 @@ static char *steam_eval_show_playing(set_t *set, char *value)
     return value;
 }
 
+static void steam_stats_log(SteamData *sata)
+{
+    const SteamHttpStats *stats;
+    const SteamHttpHist  *hist;
+    GString              *gstr;
+    guint                 i;
+    guint                 j;
+
+    static const gchar *spans[STEAM_HTTP_MARK_LAST] = {
+        [0]                        = "total",
+        [STEAM_HTTP_MARK_DISPATCH] = "queue",
+        [STEAM_HTTP_MARK_CONNECT]  = "connect",
+        [STEAM_HTTP_MARK_TLS]      = "tls",
+        [STEAM_HTTP_MARK_FIRST]    = "wait",
+        [STEAM_HTTP_MARK_DONE]     = "recv"
+    };
+
+    if (sata->api->http->stats == NULL) {
+        imcb_log(sata->ic, "HTTP statistics are disabled");
+        return;
+    }
+
+    imcb_log(sata->ic, "HTTP latency (p50/p95/p99 ms):");
+    gstr = g_string_sized_new(256);
+
+    for (i = 0; i < STEAM_API_TYPE_LAST; i++) {
+        stats = steam_http_stats_get(sata->api->http, i);
+
+        if (stats == NULL)
+            continue;
+
+        g_string_truncate(gstr, 0);
+
+        for (j = 0; j < STEAM_HTTP_MARK_LAST; j++) {
+            hist = &stats->hists[j];
+
+            if (hist->count < 1)
+                continue;
+
+            g_string_append_printf(gstr, " %s %.1f/%.1f/%.1f", spans[j],
+                                   steam_http_hist_pct(hist, 50) / 1000.0,
+                                   steam_http_hist_pct(hist, 95) / 1000.0,
+                                   steam_http_hist_pct(hist, 99) / 1000.0);
+        }
+
+        imcb_log(sata->ic, "%s (%" G_GUINT64_FORMAT "):%s",
+                 steam_api_type_str(i), stats->hists[0].count, gstr->str);
+    }
+
+    g_string_free(gstr, TRUE);
+}
+
+static char *steam_eval_http_stats(set_t *set, char *value)
+{
+    account_t *acc = set->data;
+    SteamData *sata;
+    gboolean   report;
+
+    report = (g_ascii_strcasecmp(value, "report") == 0);
+
+    if (!report && !is_bool(value))
+        return SET_INVALID;
+
+    if ((acc->ic == NULL) || (acc->ic->proto_data == NULL))
+        return report ? SET_INVALID : value;
+
+    sata = acc->ic->proto_data;
+
+    if (report) {
+        steam_stats_log(sata);
+
+        /* Reporting leaves the setting untouched */
+        return g_strdup((set->value != NULL) ? set->value : set->def);
+    }
+
+    steam_http_stats_enable(sata->api->http, bool2int(value));
+    return value;
+}
+
+static char *steam_eval_http_trace(set_t *set, char *value)
+{
+    account_t *acc = set->data;
+    SteamData *sata;
+    gboolean   dump;
+
+    dump = (g_ascii_strcasecmp(value, "dump") == 0);
+
+    if (!dump && !is_bool(value) && (g_ascii_strcasecmp(value, "error") != 0))
+        return SET_INVALID;
+
+    if ((acc->ic == NULL) || (acc->ic->proto_data == NULL))
+        return dump ? SET_INVALID : value;
+
+    sata = acc->ic->proto_data;
+
+    if (dump) {
+        steam_http_trace_dump(sata->api->http, 0, steam_trace_log, sata);
+
+        /* Dumping leaves the setting untouched */
+        return g_strdup((set->value != NULL) ? set->value : set->def);
+    }
+
+    steam_trace_apply(sata, value);
+    return value;
+}
+
+static char *steam_eval_http_pace(set_t *set, char *value)
+{
+    account_t *acc = set->data;
+    SteamData *sata;
+    gdouble    rate;
+    guint      burst;
+
+    if (!steam_pace_parse(value, &rate, &burst))
+        return SET_INVALID;
+
+    if ((acc->ic == NULL) || (acc->ic->proto_data == NULL))
+        return value;
+
+    sata = acc->ic->proto_data;
+    steam_http_pace_host(sata->api->http, rate, burst);
+
+    return value;
+}
+
+static char *steam_eval_send_lanes(set_t *set, char *value)
+{
+    account_t *acc = set->data;
+    SteamData *sata;
+    gint       lanes;
+
+    if (set_eval_int(set, value) == SET_INVALID)
+        return SET_INVALID;
+
+    lanes = g_ascii_strtoll(value, NULL, 10);
+
+    if (lanes < 1)
+        return SET_INVALID;
+
+    if ((acc->ic == NULL) || (acc->ic->proto_data == NULL))
+        return value;
+
+    sata = acc->ic->proto_data;
+    steam_http_queue_lanes(sata->api->http, lanes);
+
+    return value;
+}
+
+static char *steam_eval_backfill(set_t *set, char *value)
+{
+    account_t *acc = set->data;
+    SteamData *sata;
+    gint       max;
+
+    if (set_eval_int(set, value) == SET_INVALID)
+        return SET_INVALID;
+
+    max = g_ascii_strtoll(value, NULL, 10);
+
+    if (max < 0)
+        return SET_INVALID;
+
+    if ((acc->ic == NULL) || (acc->ic->proto_data == NULL))
+        return value;
+
+    sata = acc->ic->proto_data;
+    sata->clogmax = max;
+    steam_chatlog_next(sata);
+
+    return value;
+}
+
 static char *steam_eval_password(set_t *set, char *value)
 {
     account_t *acc = set->data;
@@ -667,6 +1213,35 @@ static void steam_init(account_t *acc)
     s->flags = SET_NULL_OK;
 
     set_add(&acc->set, "game_status", "false", steam_eval_game_status, acc);
+    set_add(&acc->set, "http_stats", "false", steam_eval_http_stats, acc);
+    set_add(&acc->set, "http_trace", "false", steam_eval_http_trace, acc);
+
+#ifdef DEBUG
+    /* Test transports and hosts, never exposed by release builds */
+    s = set_add(&acc->set, "http_record", NULL, NULL, acc);
+    s->flags = SET_NULL_OK;
+
+    s = set_add(&acc->set, "http_replay", NULL, NULL, acc);
+    s->flags = SET_NULL_OK;
+
+    set_add(&acc->set, "http_replay_latency", "-1", set_eval_int, acc);
+
+    s = set_add(&acc->set, "http_mock", NULL, NULL, acc);
+    s->flags = SET_NULL_OK;
+
+    s = set_add(&acc->set, "api_host", NULL, NULL, acc);
+    s->flags = SET_NULL_OK;
+
+    s = set_add(&acc->set, "com_host", NULL, NULL, acc);
+    s->flags = SET_NULL_OK;
+#endif
+
+    set_add(&acc->set, "send_lanes", G_STRINGIFY(STEAM_HTTP_LANES_MAX),
+            steam_eval_send_lanes, acc);
+    set_add(&acc->set, "http_pace", G_STRINGIFY(STEAM_HTTP_PACE_RATE) "/"
+            G_STRINGIFY(STEAM_HTTP_PACE_BURST), steam_eval_http_pace, acc);
+    set_add(&acc->set, "backfill", G_STRINGIFY(STEAM_CHATLOG_MAX),
+            steam_eval_backfill, acc);
     set_add(&acc->set, "password", NULL, steam_eval_password, acc);
 }
 
@@ -699,8 +1274,21 @@ static void steam_login(account_t *acc)
 static void steam_logout(struct im_connection *ic)
 {
     SteamData *sata = ic->proto_data;
+    GError    *err;
 
     steam_http_free_reqs(sata->api->http);
+    err = NULL;
+
+    if ((sata->marks != NULL) && !steam_marks_save(sata->marks, &err)) {
+        imcb_error(ic, "%s", err->message);
+        g_error_free(err);
+        err = NULL;
+    }
+
+    if ((sata->cache != NULL) && !steam_cache_save(sata->cache, &err)) {
+        imcb_error(ic, "%s", err->message);
+        g_error_free(err);
+    }
 
     if (ic->flags & OPT_LOGGED_IN)
         steam_api_logoff(sata->api, steam_logoff, sata);
@@ -714,6 +1302,9 @@ static int steam_buddy_msg(struct im_connection *ic, char *to, char *message,
     SteamData       *sata = ic->proto_data;
     SteamApiMessage *mesg;
 
+    /* Talking to a friend is the nearest thing to an open query */
+    steam_chatlog_touch(sata, to);
+
     mesg = steam_api_message_new(to);
     mesg->type = STEAM_API_MESSAGE_TYPE_SAYTEXT;
     mesg->text = g_strdup(message);
@@ -748,6 +1339,12 @@ static int steam_send_typing(struct im_connection *ic, char *who, int flags)
     SteamData       *sata = ic->proto_data;
     SteamApiMessage *mesg;
 
+    /* Steam has no notion of paused or stopped typing */
+    if (!(flags & OPT_TYPING))
+        return 0;
+
+    steam_chatlog_touch(sata, who);
+
     mesg = steam_api_message_new(who);
     mesg->type = STEAM_API_MESSAGE_TYPE_TYPING;
 
@@ -812,6 +1409,7 @@ static void steam_get_info(struct im_connection *ic, char *who)
 {
     SteamData *sata = ic->proto_data;
 
+    steam_chatlog_touch(sata, who);
     steam_api_summary(sata->api, who, steam_summary, sata);
 }
 
@@ -868,4 +1466,8 @@ void init_plugin()
     pp->buddy_data_free = steam_buddy_data_free;
 
     register_protocol(pp);
+
+    /* Have the addresses ready by the time the first account logs in */
+    steam_http_dns_prefetch(STEAM_API_HOST);
+    steam_http_dns_prefetch(STEAM_COM_HOST);
 }
@@ -21,8 +21,26 @@
 #include <bitlbee.h>
 
 #include "steam-api.h"
+#include "steam-cache.h"
+#include "steam-mark.h"
 
-typedef struct _SteamData SteamData;
+#define STEAM_CHATLOG_IDLE 30
+#define STEAM_CHATLOG_MAX  2
+
+typedef struct _SteamChatlog SteamChatlog;
+typedef struct _SteamData    SteamData;
+
+struct _SteamChatlog
+{
+    SteamData *sata;
+    gchar     *steamid;
+    gint64     since;
+    guint32    hash;
+    gint64     until;
+
+    gboolean urgent;
+    gboolean busy;
+};
 
 struct _SteamData
 {
@@ -30,6 +48,18 @@ struct _SteamData
     struct im_connection *ic;
 
     gint64 tstamp;
+    gint64 active;
+    gint64 clock;
+
+    SteamCache *cache;
+    SteamMarks *marks;
+
+    GHashTable *clogs;
+    GQueue     *clogq;
+    GQueue     *clogd;
+    guint       clogn;
+    guint       clogmax;
+    gint        clogev;
 
     gboolean game_status;
     gint     show_playing;
@@ -0,0 +1,122 @@
+#!/bin/bash
+#
+# Drives the plugin against its built-in Steam API mock through a local
+# bitlbee: login, the long poll, and the fault modes. Requires a plugin
+# built with --enable-debug. Exits with 77 (skipped) when bitlbee or such
+# a plugin is not available.
+#
+#   BITLBEE  bitlbee binary (default: bitlbee from $PATH)
+#   PLUGIN   built plugin (default: steam/.libs/steam.so)
+
+BITLBEE=${BITLBEE:-bitlbee}
+PLUGIN=${PLUGIN:-steam/.libs/steam.so}
+PORT=$((20000 + $$ % 10000))
+NICK=mocktest
+MOCK=friends=50,rate=2,churn=10,poll=200
+
+command -v "$BITLBEE" >/dev/null 2>&1 || exit 77
+test -f "$PLUGIN" || exit 77
+
+# The mock is only compiled into debug builds
+grep -q http_mock "$PLUGIN" || exit 77
+
+tmp=$(mktemp -d) || exit 1
+pid=
+
+cleanup() {
+    test -n "$pid" && kill "$pid" 2>/dev/null
+    rm -rf "$tmp"
+}
+
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    echo "--- IRC log" >&2
+    cat "$tmp/irc.log" >&2
+    exit 1
+}
+
+mkdir "$tmp/conf" "$tmp/plugins"
+cp "$PLUGIN" "$tmp/plugins/steam.so"
+
+cat > "$tmp/bitlbee.conf" <<EOF
+[settings]
+RunMode = Daemon
+AuthMode = Open
+DaemonInterface = 127.0.0.1
+DaemonPort = $PORT
+ConfigDir = $tmp/conf
+PluginDir = $tmp/plugins
+EOF
+
+"$BITLBEE" -D -n -c "$tmp/bitlbee.conf" -d "$tmp/conf" 2>"$tmp/bitlbee.log" &
+pid=$!
+
+for i in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+    sleep 0.1
+done
+
+kill -0 "$pid" 2>/dev/null || fail "bitlbee did not start"
+exec 3<>/dev/tcp/127.0.0.1/$PORT || fail "cannot connect to bitlbee"
+
+send() {
+    printf '%s\r\n' "$*" >&3
+}
+
+cmd() {
+    send "PRIVMSG &bitlbee :$*"
+}
+
+# Waits up to $2 seconds for a line matching $1, answering pings meanwhile
+wait_for() {
+    local end=$((SECONDS + $2))
+    local line
+
+    while [ $SECONDS -lt $end ]; do
+        IFS= read -r -t 1 line <&3 || continue
+        line=${line%$'\r'}
+        echo "$line" >> "$tmp/irc.log"
+
+        case "$line" in
+        PING*)
+            send "PONG ${line#PING }"
+            ;;
+        *$1*)
+            return 0
+            ;;
+        esac
+    done
+
+    kill -0 "$pid" 2>/dev/null || fail "bitlbee exited waiting for: $1"
+    fail "timed out waiting for: $1"
+}
+
+send "NICK $NICK"
+send "USER $NICK 0 * :$NICK"
+wait_for " 001 " 10
+
+# Login: key, auth, logon, friends and summaries
+cmd "account add steam mock mock"
+cmd "account steam set http_mock $MOCK"
+cmd "account steam on"
+wait_for "Logged in" 30
+echo "PASS: login"
+
+# Poll: the mock's messages reach the user
+wait_for "Mock message" 30
+echo "PASS: poll"
+
+# Faults: expired sessions, server errors and held requests. A held
+# request only fails on the HTTP request timeout, so allow for a few.
+cmd "account steam off"
+cmd "account steam set http_mock $MOCK,faults=20"
+cmd "account steam on"
+wait_for "Logged in" 300
+wait_for "Mock message" 300
+echo "PASS: faults"
+
+kill -0 "$pid" 2>/dev/null || fail "bitlbee exited"
+send "QUIT"
+exit 0